@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <linux/rtc.h>
+
+#include "hyper.h"
+#include "clock.h"
+
+/* a dynamic posix clock id for a /dev/ptpN fd, see clock_getres(2) */
+#define FD_TO_CLOCKID(fd)	((~(clockid_t)(fd) << 3) | 3)
+
+/* offsets smaller than this are slewed by adjtime(), bigger ones stepped */
+#define HYPER_CLOCK_SLEW_NS	500000000LL
+
+#define HYPER_KVM_PTP_NAME	"KVM virtual PTP"
+
+/*
+ * The /dev/ptpN of ptp_kvm, -1 if there is none. Other ptp clocks, e.g.
+ * the PHC of a passthrough NIC, don't follow the host clock.
+ */
+static int hyper_kvm_ptp_index(void)
+{
+	static int index = -2;
+	char path[64], name[64];
+	ssize_t size;
+	int i, fd;
+
+	if (index != -2)
+		return index;
+
+	index = -1;
+	for (i = 0; i < 16; i++) {
+		sprintf(path, "/sys/class/ptp/ptp%d/clock_name", i);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			if (errno == ENOENT)
+				break;
+			continue;
+		}
+		size = read(fd, name, sizeof(name) - 1);
+		close(fd);
+		if (size <= 0)
+			continue;
+
+		name[size] = '\0';
+		if (name[size - 1] == '\n')
+			name[size - 1] = '\0';
+		if (strcmp(name, HYPER_KVM_PTP_NAME) == 0) {
+			index = i;
+			break;
+		}
+	}
+
+	fprintf(stdout, "kvm ptp clock is ptp%d\n", index);
+	return index;
+}
+
+/*
+ * ptp_kvm exposes the host CLOCK_REALTIME with ns precision, prefer it
+ * over the rtc which only has a 1s resolution.
+ */
+static int hyper_read_ptp(struct timespec *ts)
+{
+	char path[32];
+	int fd, ret;
+
+	if (hyper_kvm_ptp_index() < 0)
+		return -1;
+
+	sprintf(path, "/dev/ptp%d", hyper_kvm_ptp_index());
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	ret = clock_gettime(FD_TO_CLOCKID(fd), ts);
+	if (ret < 0)
+		perror("read ptp clock failed");
+
+	close(fd);
+	return ret;
+}
+
+static int hyper_read_rtc(struct timespec *ts)
+{
+	struct rtc_time rtc;
+	struct tm tm;
+	int fd;
+
+	fd = open("/dev/rtc0", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		fd = open("/dev/rtc", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror("open rtc device failed");
+		return -1;
+	}
+
+	memset(&rtc, 0, sizeof(rtc));
+	if (ioctl(fd, RTC_RD_TIME, &rtc) < 0) {
+		perror("read rtc time failed");
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	/* the hypervisor keeps the rtc in utc */
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_sec = rtc.tm_sec;
+	tm.tm_min = rtc.tm_min;
+	tm.tm_hour = rtc.tm_hour;
+	tm.tm_mday = rtc.tm_mday;
+	tm.tm_mon = rtc.tm_mon;
+	tm.tm_year = rtc.tm_year;
+
+	ts->tv_sec = timegm(&tm);
+	ts->tv_nsec = 0;
+	return ts->tv_sec == (time_t)-1 ? -1 : 0;
+}
+
+/* set the system clock from the host, like `hwclock -s` without the fork */
+int hyper_sync_time(void)
+{
+	struct timespec host, now;
+	struct timeval delta;
+	long long offset;
+	int ptp = 1;
+
+	if (hyper_read_ptp(&host) < 0) {
+		ptp = 0;
+		if (hyper_read_rtc(&host) < 0) {
+			fprintf(stderr, "no clock source to sync time from\n");
+			return -1;
+		}
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	offset = (host.tv_sec - now.tv_sec) * 1000000000LL + host.tv_nsec - now.tv_nsec;
+
+	/* the rtc can't tell a sub-second drift */
+	if (!ptp && offset > -1000000000LL && offset < 1000000000LL)
+		return 0;
+
+	if (offset > -HYPER_CLOCK_SLEW_NS && offset < HYPER_CLOCK_SLEW_NS) {
+		delta.tv_sec = 0;
+		delta.tv_usec = offset / 1000;
+		if (adjtime(&delta, NULL) < 0) {
+			perror("adjust time failed");
+			return -1;
+		}
+		return 0;
+	}
+
+	if (clock_settime(CLOCK_REALTIME, &host) < 0) {
+		perror("set time failed");
+		return -1;
+	}
+
+	fprintf(stdout, "sync time from %s, offset %lld ns\n", ptp ? "ptp" : "rtc", offset);
+	return 0;
+}
+
+int hyper_clock_timer_open(void)
+{
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		perror("create time sync timer failed");
+
+	return fd;
+}
+
+static int hyper_arm_time_sync(uint32_t interval)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = its.it_interval.tv_sec = interval;
+	if (timerfd_settime(ctl.clock.fd, 0, &its, NULL) < 0) {
+		perror("set time sync timer failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+int hyper_setup_time_sync(struct hyper_pod *pod)
+{
+	if (pod->time_sync == 0)
+		return 0;
+
+	fprintf(stdout, "sync time every %" PRIu32 " seconds\n", pod->time_sync);
+	return hyper_arm_time_sync(pod->time_sync);
+}
+
+void hyper_cleanup_time_sync(struct hyper_pod *pod)
+{
+	if (pod->time_sync > 0)
+		hyper_arm_time_sync(0);
+	pod->time_sync = 0;
+}
+
+static int hyper_clock_timer_read(struct hyper_event *he, int efd)
+{
+	uint64_t expired;
+
+	if (read(he->fd, &expired, sizeof(expired)) < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			perror("read time sync timer failed");
+		return 0;
+	}
+
+	hyper_sync_time();
+	return 0;
+}
+
+struct hyper_event_ops hyper_clock_ops = {
+	.read		= hyper_clock_timer_read,
+};
@@ -0,0 +1,16 @@
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <stdint.h>
+
+#include "event.h"
+
+struct hyper_pod;
+
+int hyper_sync_time(void);
+int hyper_clock_timer_open(void);
+int hyper_setup_time_sync(struct hyper_pod *pod);
+void hyper_cleanup_time_sync(struct hyper_pod *pod);
+
+extern struct hyper_event_ops hyper_clock_ops;
+#endif
@@ -14,14 +14,23 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <limits.h>
 
 #include "util.h"
 #include "hyper.h"
 #include "parse.h"
 #include "syscall.h"
+#include "copy.h"
+#include "uevent.h"
 
 const char *INIT_VOLUME_FILENAME = ".hyper_file_volume_data_do_not_create_on_your_own";
 const char *INIT_VOLUME_MOUNTPOINT_FSTYPE= "hyper_volume_mountpoint_init_fstype";
+const char *LAZY_VOLUME_MARKER = ".hyper_lazy_volume";
+const char *LAZY_VOLUME_MATERIALIZED = ".hyper_lazy_volume_materialized";
 
 static int container_populate_volume(char *src, char *dest)
 {
@@ -52,6 +61,34 @@ static int container_populate_volume(char *src, char *dest)
 	return hyper_copy_dir(src, dest);
 }
 
+/* resolve a rootfs or volume disk to its /dev path, waiting for it to appear */
+static int container_wait_device(char *scsiaddr, char *pciaddr, char *name, char *dev)
+{
+	struct hyper_device d = {
+		.type	= HYPER_DEV_NAME,
+		.id	= name,
+	};
+
+	if (scsiaddr) {
+		d.type = HYPER_DEV_SCSI;
+		d.id = scsiaddr;
+	} else if (pciaddr) {
+		d.type = HYPER_DEV_PCI;
+		d.id = pciaddr;
+	}
+
+	if (d.id == NULL) {
+		fprintf(stderr, "no device given\n");
+		return -1;
+	}
+
+	if (hyper_wait_device(&d, HYPER_DEVICE_TIMEOUT) < 0)
+		return -1;
+
+	sprintf(dev, "/dev/%s", d.name);
+	return 0;
+}
+
 static int container_check_file_volume(char *hyper_path, const char **filename)
 {
 	struct dirent **list;
@@ -94,103 +131,454 @@ static int container_check_file_volume(char *hyper_path, const char **filename)
 	return 0;
 }
 
+/*
+ * Trigger overlayfs copy-up of everything under the merged directory fd
+ * while the container may be using it, so nothing is written back: an
+ * O_WRONLY open copies up regular files with their data (the overlay is
+ * mounted with metacopy=off), a chown to -1:-1 the rest. Regular files
+ * aren't chowned as that would drop their suid/sgid bits.
+ */
+static int container_materialize_dir(int dirfd)
+{
+	struct dirent *de;
+	struct stat st;
+	int fd, ret = 0;
+	DIR *dp;
+
+	dp = fdopendir(dirfd);
+	if (dp == NULL) {
+		close(dirfd);
+		return -1;
+	}
+
+	while ((de = readdir(dp)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		if (fstatat(dirfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+			continue;
+
+		if (S_ISREG(st.st_mode)) {
+			fd = openat(dirfd, de->d_name, O_WRONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+			if (fd < 0) {
+				/* removed or replaced by the container meanwhile */
+				if (errno != ENOENT && errno != ELOOP)
+					ret = -1;
+				continue;
+			}
+			close(fd);
+			continue;
+		}
+
+		if (fchownat(dirfd, de->d_name, -1, -1, AT_SYMLINK_NOFOLLOW) < 0) {
+			if (errno != ENOENT)
+				ret = -1;
+			continue;
+		}
+
+		if (!S_ISDIR(st.st_mode))
+			continue;
+
+		fd = openat(dirfd, de->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (fd < 0 || container_materialize_dir(fd) < 0)
+			ret = -1;
+	}
+
+	closedir(dp);
+	return ret;
+}
+
+static void container_materialize_volume(int mergedfd, int volfd)
+{
+	int pid, fd;
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork volume materializer failed");
+		return;
+	} else if (pid > 0) {
+		return;
+	}
+
+	/* don't compete with the container for io and cpu */
+	setpriority(PRIO_PROCESS, 0, 19);
+
+	if (container_materialize_dir(mergedfd) < 0) {
+		fprintf(stderr, "materialize volume failed, retry on next start\n");
+		_exit(1);
+	}
+
+	syncfs(volfd);
+	fd = openat(volfd, LAZY_VOLUME_MATERIALIZED, O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+	if (fd < 0)
+		_exit(1);
+	fsync(fd);
+	close(fd);
+	_exit(0);
+}
+
+/*
+ * Remove every trusted.overlay.* xattr (opaque, origin, redirect, metacopy,
+ * impure, ...) of path, or of fd if path is NULL. A later overlay over the
+ * dir would misread them.
+ */
+static int container_drop_overlay_xattrs(int fd, const char *path)
+{
+	char list[4096], *name;
+	ssize_t size;
+	int ret = 0;
+
+	size = path ? llistxattr(path, list, sizeof(list)) : flistxattr(fd, list, sizeof(list));
+	if (size < 0)
+		return errno == ENOTSUP ? 0 : -1;
+
+	for (name = list; name < list + size; name += strlen(name) + 1) {
+		if (strncmp(name, "trusted.overlay.", 16))
+			continue;
+		if ((path ? lremovexattr(path, name) : fremovexattr(fd, name)) < 0 &&
+		    errno != ENODATA)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+/* drop whiteouts and overlay xattrs left in a former upper dir */
+static int container_cleanup_whiteouts(int dirfd)
+{
+	char path[64 + NAME_MAX];
+	struct dirent *de;
+	struct stat st;
+	int fd, ret = 0;
+	DIR *dp;
+
+	if (container_drop_overlay_xattrs(dirfd, NULL) < 0)
+		ret = -1;
+
+	dp = fdopendir(dirfd);
+	if (dp == NULL) {
+		close(dirfd);
+		return -1;
+	}
+
+	while ((de = readdir(dp)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		if (fstatat(dirfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+			ret = -1;
+			continue;
+		}
+
+		if (S_ISCHR(st.st_mode) && st.st_rdev == makedev(0, 0)) {
+			if (unlinkat(dirfd, de->d_name, 0) < 0)
+				ret = -1;
+			continue;
+		}
+
+		if (!S_ISDIR(st.st_mode)) {
+			snprintf(path, sizeof(path), "/proc/self/fd/%d/%s", dirfd, de->d_name);
+			if (container_drop_overlay_xattrs(-1, path) < 0)
+				ret = -1;
+			continue;
+		}
+
+		fd = openat(dirfd, de->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (fd < 0 || container_cleanup_whiteouts(fd) < 0)
+			ret = -1;
+	}
+
+	closedir(dp);
+	return ret;
+}
+
+/*
+ * Lazy docker volumes are an overlay with the image content at the
+ * mountpoint as lower dir and the volume _data as upper dir, so nothing
+ * is copied at start. The LAZY_VOLUME_MARKER file in the volume root says
+ * _data is an upper dir and must be mounted the same way next time, until
+ * the background materializer has copied everything up. Returns 1 if the
+ * volume was mounted, 0 if it is to be bind mounted as usual.
+ */
+static int container_setup_lazy_volume(struct hyper_container *container,
+				       struct volume *vol, char *path, char *mountpoint)
+{
+	char volume[512], work[512], options[1600];
+	int volfd, mergedfd, fd, ret = -1;
+	struct stat st;
+
+	volfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (volfd < 0) {
+		perror("open volume failed");
+		return -1;
+	}
+
+	if (faccessat(volfd, LAZY_VOLUME_MARKER, F_OK, 0) == 0) {
+		if (faccessat(volfd, LAZY_VOLUME_MATERIALIZED, F_OK, 0) == 0) {
+			fprintf(stdout, "volume %s is materialized\n", vol->mountpoint);
+			fd = openat(volfd, "_data", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (fd < 0 || container_cleanup_whiteouts(fd) < 0) {
+				fprintf(stderr, "cleanup whiteouts of %s failed\n", vol->mountpoint);
+				goto out;
+			}
+			unlinkat(volfd, LAZY_VOLUME_MARKER, 0);
+			unlinkat(volfd, LAZY_VOLUME_MATERIALIZED, 0);
+			ret = 0;
+			goto out;
+		}
+	} else if (vol->populate == POPULATE_COPY || !container->initialize ||
+		   fstatat(volfd, "_data", &st, 0) == 0) {
+		/* not lazy, or already populated */
+		ret = 0;
+		goto out;
+	}
+
+	if (snprintf(volume, sizeof(volume), "%s/_data", path) >= sizeof(volume) ||
+	    snprintf(work, sizeof(work), "%s/_work", path) >= sizeof(work)) {
+		fprintf(stderr, "volume path %s too long\n", path);
+		goto out;
+	}
+	if (hyper_mkdir(volume, 0777) < 0 || hyper_mkdir(work, 0700) < 0) {
+		perror("create overlay dirs of volume failed");
+		goto out;
+	}
+
+	/* record the layout before the first write to _data */
+	fd = openat(volfd, LAZY_VOLUME_MARKER, O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		perror("create lazy volume marker failed");
+		goto out;
+	}
+	fsync(fd);
+	close(fd);
+
+	/*
+	 * The materializer needs copy-up to move file data into _data, with
+	 * metacopy only the metadata would be there once _data is mounted
+	 * alone. Kernels rejecting the option have no metacopy at all.
+	 */
+	snprintf(options, sizeof(options), "lowerdir=%s,upperdir=%s,workdir=%s,metacopy=off",
+		 mountpoint, volume, work);
+	fprintf(stdout, "mount lazy volume %s, %s\n", vol->mountpoint, options);
+	if (mount("overlay", mountpoint, "overlay", 0, options) < 0) {
+		if (errno != EINVAL) {
+			perror("mount lazy volume failed");
+			goto out;
+		}
+		*strrchr(options, ',') = '\0';
+		fprintf(stdout, "retry lazy volume mount without metacopy=off\n");
+		if (mount("overlay", mountpoint, "overlay", 0, options) < 0) {
+			perror("mount lazy volume failed");
+			goto out;
+		}
+	}
+
+	if (vol->readonly &&
+	    mount(mountpoint, mountpoint, NULL, MS_BIND | MS_REMOUNT | MS_RDONLY, NULL) < 0) {
+		perror("remount lazy volume readonly failed");
+		goto out;
+	}
+
+	if (vol->populate == POPULATE_BACKGROUND && !vol->readonly) {
+		mergedfd = open(mountpoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (mergedfd >= 0) {
+			container_materialize_volume(mergedfd, volfd);
+			close(mergedfd);
+		}
+	}
+
+	/* the overlay pins the volume, detach it from /tmp */
+	umount2(path, MNT_DETACH);
+	ret = 1;
+out:
+	close(volfd);
+	return ret;
+}
+
+/*
+ * Mount the device of volume i at its temporary path and look at its
+ * content. Returns 1 for a file volume, 0 for a directory, -1 on error.
+ */
+static int container_prepare_volume(struct hyper_container *container, int i, char *path)
+{
+	struct volume *vol = &container->vols[i];
+	const char *filevolume = NULL;
+	char dev[512], volume[512];
+	char *options = NULL;
+
+	if (container_wait_device(vol->scsiaddr, vol->pciaddr, vol->device, dev) < 0) {
+		fprintf(stderr, "volume %s device is not ready\n", vol->mountpoint);
+		return -1;
+	}
+
+	fprintf(stdout, "mount %s to %s, tmp path %s\n",
+		dev, vol->mountpoint, path);
+
+	if (hyper_mkdir(path, 0755) < 0) {
+		perror("create volume dir failed");
+		return -1;
+	}
+
+	if (!strncmp(vol->fstype, "xfs", strlen("xfs")))
+		options = "nouuid";
+
+	if (mount(dev, path, vol->fstype, 0, options) < 0) {
+		perror("mount volume device failed");
+		return -1;
+	}
+
+	sprintf(volume, "/%s/_data", path);
+	if (container_check_file_volume(volume, &filevolume) < 0)
+		return -1;
+
+	return filevolume != NULL;
+}
+
+static int container_volume_path(struct hyper_container *container, int i, char *path)
+{
+	/* flat, so nested mountpoints don't end up inside another volume */
+	return sprintf(path, "/tmp/hyper/%s/volume-%d", container->id, i);
+}
+
+/*
+ * Mounting a device may replay a journal, do it for all volumes at once
+ * in helper processes sharing our mount namespace. state[i] gets the
+ * result of container_prepare_volume(), or 2 for a fake device.
+ */
+static int container_prepare_volumes(struct hyper_container *container, int *state)
+{
+	char path[512];
+	int i, status, ret = 0;
+	pid_t *pids;
+
+	pids = calloc(container->vols_num, sizeof(*pids));
+	if (pids == NULL) {
+		fprintf(stderr, "allocate volume helpers failed\n");
+		return -1;
+	}
+
+	for (i = 0; i < container->vols_num; i++) {
+		if (!strcmp(container->vols[i].fstype, INIT_VOLUME_MOUNTPOINT_FSTYPE)) {
+			state[i] = 2;
+			continue;
+		}
+
+		container_volume_path(container, i, path);
+		if (container->vols_num == 1 || (pids[i] = fork()) < 0) {
+			/* one volume or no helper, do it here */
+			pids[i] = 0;
+			state[i] = container_prepare_volume(container, i, path);
+			if (state[i] < 0)
+				ret = -1;
+		} else if (pids[i] == 0) {
+			_exit(container_prepare_volume(container, i, path) + 1);
+		}
+	}
+
+	for (i = 0; i < container->vols_num; i++) {
+		if (pids[i] <= 0)
+			continue;
+
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) == 0) {
+			fprintf(stderr, "prepare volume %s failed\n",
+				container->vols[i].mountpoint);
+			ret = -1;
+			continue;
+		}
+		state[i] = WEXITSTATUS(status) - 1;
+	}
+
+	free(pids);
+	return ret;
+}
+
 static int container_setup_volume(struct hyper_container *container)
 {
-	int i;
-	char dev[512], path[512];
+	int i, *state;
+	char path[512];
 	struct volume *vol;
 
+	state = calloc(container->vols_num + 1, sizeof(*state));
+	if (state == NULL) {
+		fprintf(stderr, "allocate volume state failed\n");
+		return -1;
+	}
+
+	if (container_prepare_volumes(container, state) < 0)
+		goto fail;
+
+	/* the mountpoints may be nested, mount them in the given order */
 	for (i = 0; i < container->vols_num; i++) {
 		char volume[512];
 		char mountpoint[512];
-		char *options = NULL;
-		const char *filevolume = NULL;
 		vol = &container->vols[i];
 
 		sprintf(mountpoint, "./%s", vol->mountpoint);
-		if (!strcmp(vol->fstype, INIT_VOLUME_MOUNTPOINT_FSTYPE)) {
+		if (state[i] == 2) {
 			fprintf(stdout, "create special mountpoint %s, skip mounting fake device\n", mountpoint);
 			if (hyper_mkdir(mountpoint, 0777) < 0) {
 				perror("create fake device mountpoint failed");
-				return -1;
+				goto fail;
 			}
-			if (mount(mountpoint, mountpoint, NULL, MS_BIND, NULL) < 0) {
+			if (hyper_bind_mount(mountpoint, mountpoint, 0) < 0) {
 				perror("mount fake device failed");
-				return -1;
+				goto fail;
 			}
 			continue;
 		}
 
-		if (vol->scsiaddr) {
-			hyper_find_sd(vol->scsiaddr, &vol->device);
-		}
-
-		sprintf(dev, "/dev/%s", vol->device);
-		sprintf(path, "/tmp/%s", vol->mountpoint);
-
-		fprintf(stdout, "mount %s to %s, tmp path %s\n",
-			dev, vol->mountpoint, path);
-
-		if (hyper_mkdir(path, 0755) < 0) {
-			perror("create volume dir failed");
-			return -1;
-		}
-
-		if (!strncmp(vol->fstype, "xfs", strlen("xfs")))
-			options = "nouuid";
-
-		if (mount(dev, path, vol->fstype, 0, options) < 0) {
-			perror("mount volume device failed");
-			return -1;
-		}
-
+		container_volume_path(container, i, path);
 		sprintf(volume, "/%s/_data", path);
-		if (container_check_file_volume(volume, &filevolume) < 0)
-			return -1;
 
-		if (filevolume == NULL) {
+		if (state[i] == 0) {
 			if (hyper_mkdir(mountpoint, 0755) < 0) {
 				perror("create volume dir failed");
-				return -1;
+				goto fail;
 			}
 			if (vol->docker) {
+				int lazy = container_setup_lazy_volume(container, vol,
+								       path, mountpoint);
+				if (lazy < 0) {
+					fprintf(stderr, "fail to setup lazy volume %s\n", mountpoint);
+					goto fail;
+				} else if (lazy > 0) {
+					continue;
+				}
+
 				if (container->initialize &&
 				    (container_populate_volume(mountpoint, volume) < 0)) {
 					fprintf(stderr, "fail to populate volume %s\n", mountpoint);
-					return -1;
+					goto fail;
 				}
 			} else if (hyper_mkdir(volume, 0777) < 0) {
 				/* First time mounting an empty volume */
 				perror("create _data dir failed");
-				return -1;
+				goto fail;
 			}
 		} else {
 			hyper_filize(mountpoint);
 			if (hyper_create_file(mountpoint) < 0) {
 				perror("create volume file failed");
-				return -1;
+				goto fail;
 			}
-			sprintf(volume, "/%s/_data/%s", path, filevolume);
+			sprintf(volume, "/%s/_data/%s", path, INIT_VOLUME_FILENAME);
 			/* 0777 so that any user can read/write the new file volume */
 			if (chmod(volume, 0777) < 0) {
 				fprintf(stderr, "fail to chmod directroy %s\n", volume);
-				return -1;
+				goto fail;
 			}
 		}
 
-		if (mount(volume, mountpoint, NULL, MS_BIND, NULL) < 0) {
+		if (hyper_bind_mount(volume, mountpoint,
+				     vol->readonly ? HYPER_BIND_RDONLY : 0) < 0) {
 			perror("mount volume device failed");
-			return -1;
-		}
-
-		if (vol->readonly &&
-		    mount(volume, mountpoint, NULL, MS_BIND | MS_REMOUNT | MS_RDONLY, NULL) < 0) {
-			perror("mount fsmap failed");
-			return -1;
+			goto fail;
 		}
 
 		umount(path);
 	}
+	free(state);
 
 	for (i = 0; i < container->maps_num; i++) {
 		struct stat st;
@@ -229,19 +617,15 @@ static int container_setup_volume(struct hyper_container *container)
 			close(fd);
 		}
 
-		if (mount(src, mountpoint, NULL, MS_BIND, NULL) < 0) {
-			perror("mount fsmap failed");
-			continue;
-		}
-
-		if (map->readonly == 0)
-			continue;
-
-		if (mount(src, mountpoint, NULL, MS_BIND | MS_REMOUNT | MS_RDONLY, NULL) < 0)
+		if (hyper_bind_mount(src, mountpoint, map->readonly ? HYPER_BIND_RDONLY : 0) < 0)
 			perror("mount fsmap failed");
 	}
 
 	return 0;
+
+fail:
+	free(state);
+	return -1;
 }
 
 static int container_setup_modules(struct hyper_container *container)
@@ -278,7 +662,7 @@ static int container_setup_modules(struct hyper_container *container)
 		return -1;
 	}
 
-	if (mount(src, dst, NULL, MS_BIND, NULL) < 0) {
+	if (hyper_bind_mount(src, dst, 0) < 0) {
 		perror("mount bind modules failed");
 		return -1;
 	}
@@ -286,9 +670,110 @@ static int container_setup_modules(struct hyper_container *container)
 	return 0;
 }
 
+#define HYPER_MOUNT_TEMPLATE	"/tmp/hyper/template"
+
+static int container_setup_dev_links(const char *dev)
+{
+	char path[512];
+
+	sprintf(path, "%s/ptmx", dev);
+	if (unlink(path) < 0)
+		perror("remove /dev/ptmx failed");
+	if (symlink("/dev/pts/ptmx", path) < 0)
+		perror("link /dev/pts/ptmx to /dev/ptmx failed");
+
+	sprintf(path, "%s/fd", dev);
+	symlink("/proc/self/fd", path);
+	sprintf(path, "%s/stdin", dev);
+	symlink("/proc/self/fd/0", path);
+	sprintf(path, "%s/stdout", dev);
+	symlink("/proc/self/fd/1", path);
+	sprintf(path, "%s/stderr", dev);
+	symlink("/proc/self/fd/2", path);
+
+	return 0;
+}
+
+/* runs in the pod pidns, so proc shows the pod's processes */
+static int hyper_mount_template(void)
+{
+	if (hyper_mkdir(HYPER_MOUNT_TEMPLATE "/proc", 0755) < 0 ||
+	    hyper_mkdir(HYPER_MOUNT_TEMPLATE "/sys", 0755) < 0 ||
+	    hyper_mkdir(HYPER_MOUNT_TEMPLATE "/dev", 0755) < 0) {
+		fprintf(stderr, "create mount template dirs failed\n");
+		return -1;
+	}
+
+	if (mount("proc", HYPER_MOUNT_TEMPLATE "/proc", "proc", MS_NOSUID| MS_NODEV| MS_NOEXEC, NULL) < 0 ||
+	    mount("sysfs", HYPER_MOUNT_TEMPLATE "/sys", "sysfs", MS_NOSUID| MS_NODEV| MS_NOEXEC, NULL) < 0 ||
+	    mount("devtmpfs", HYPER_MOUNT_TEMPLATE "/dev", "devtmpfs", MS_NOSUID, NULL) < 0) {
+		perror("mount template filesystem failed");
+		return -1;
+	}
+
+	/* devtmpfs is a single instance, the links are shared by all containers */
+	return container_setup_dev_links(HYPER_MOUNT_TEMPLATE "/dev");
+}
+
+/*
+ * Mount proc, sysfs and devtmpfs for the whole pod once, in the mount ns
+ * of init which every container's ns is copied from. Containers clone
+ * them instead of mounting their own. shm, devpts and the init layer are
+ * per container and still set up by each of them.
+ */
+int hyper_setup_mount_template(struct hyper_pod *pod)
+{
+	int pipe[2] = {-1, -1}, pid, status, ret = -1;
+	uint32_t type;
+
+	if (pipe2(pipe, O_CLOEXEC) < 0) {
+		perror("create pipe for mount template failed");
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork mount template helper failed");
+		goto out;
+	} else if (pid == 0) {
+		if (hyper_enter_sandbox(pod, -1) < 0)
+			_exit(125);
+		hyper_send_type(pipe[1], hyper_mount_template() < 0 ? ERROR : READY);
+		_exit(0);
+	}
+
+	close(pipe[1]);
+	pipe[1] = -1;
+
+	if (hyper_get_type(pipe[0], &type) < 0 || type != READY) {
+		fprintf(stderr, "setup mount template failed\n");
+		hyper_cleanup_mount_template();
+	} else {
+		ret = 0;
+	}
+
+	waitpid(pid, &status, 0);
+out:
+	close(pipe[0]);
+	close(pipe[1]);
+	return ret;
+}
+
+void hyper_cleanup_mount_template(void)
+{
+	umount2(HYPER_MOUNT_TEMPLATE "/proc", MNT_DETACH);
+	umount2(HYPER_MOUNT_TEMPLATE "/sys", MNT_DETACH);
+	umount2(HYPER_MOUNT_TEMPLATE "/dev", MNT_DETACH);
+	rmdir(HYPER_MOUNT_TEMPLATE "/proc");
+	rmdir(HYPER_MOUNT_TEMPLATE "/sys");
+	rmdir(HYPER_MOUNT_TEMPLATE "/dev");
+	rmdir(HYPER_MOUNT_TEMPLATE);
+}
+
 static int container_setup_mount(struct hyper_container *container)
 {
 	char src[512];
+	struct stat st;
 
 	// current dir is container rootfs, the operations on "./PATH" are the operations on container's "/PATH"
 	hyper_mkdir("./proc", 0755);
@@ -296,11 +781,20 @@ static int container_setup_mount(struct hyper_container *container)
 	hyper_mkdir("./dev", 0755);
 	hyper_mkdir("./lib/modules", 0755);
 
-	if (mount("proc", "./proc", "proc", MS_NOSUID| MS_NODEV| MS_NOEXEC, NULL) < 0 ||
-	    mount("sysfs", "./sys", "sysfs", MS_NOSUID| MS_NODEV| MS_NOEXEC, NULL) < 0 ||
-	    mount("devtmpfs", "./dev", "devtmpfs", MS_NOSUID, NULL) < 0) {
+	if (stat(HYPER_MOUNT_TEMPLATE "/proc/self", &st) == 0) {
+		if (hyper_bind_mount(HYPER_MOUNT_TEMPLATE "/proc", "./proc", HYPER_BIND_RECURSIVE) < 0 ||
+		    hyper_bind_mount(HYPER_MOUNT_TEMPLATE "/sys", "./sys", HYPER_BIND_RECURSIVE) < 0 ||
+		    hyper_bind_mount(HYPER_MOUNT_TEMPLATE "/dev", "./dev", HYPER_BIND_RECURSIVE) < 0) {
+			perror("clone mount template for container failed");
+			return -1;
+		}
+	} else if (mount("proc", "./proc", "proc", MS_NOSUID| MS_NODEV| MS_NOEXEC, NULL) < 0 ||
+		   mount("sysfs", "./sys", "sysfs", MS_NOSUID| MS_NODEV| MS_NOEXEC, NULL) < 0 ||
+		   mount("devtmpfs", "./dev", "devtmpfs", MS_NOSUID, NULL) < 0) {
 		perror("mount basic filesystem for container failed");
 		return -1;
+	} else {
+		container_setup_dev_links("./dev");
 	}
 
 	if (hyper_mkdir("./dev/shm", 0755) < 0) {
@@ -323,21 +817,11 @@ static int container_setup_mount(struct hyper_container *container)
 		return -1;
 	}
 
-	if (mount(src, "./dev/pts/", NULL, MS_BIND, NULL) < 0) {
+	if (hyper_bind_mount(src, "./dev/pts/", 0) < 0) {
 		perror("move pts to /dev/pts failed");
 		return -1;
 	}
 
-	if (unlink("./dev/ptmx") < 0)
-		perror("remove /dev/ptmx failed");
-	if (symlink("/dev/pts/ptmx", "./dev/ptmx") < 0)
-		perror("link /dev/pts/ptmx to /dev/ptmx failed");
-
-	symlink("/proc/self/fd", "./dev/fd");
-	symlink("/proc/self/fd/0", "./dev/stdin");
-	symlink("/proc/self/fd/1", "./dev/stdout");
-	symlink("/proc/self/fd/2", "./dev/stderr");
-
 	return 0;
 }
 
@@ -444,7 +928,7 @@ static int container_setup_dns(struct hyper_container *container)
 	}
 	close(fd);
 
-	if (mount(src, "./etc/resolv.conf", NULL, MS_BIND, NULL) < 0) {
+	if (hyper_bind_mount(src, "./etc/resolv.conf", 0) < 0) {
 		perror("bind to /etc/resolv.conf failed");
 		return -1;
 	}
@@ -462,49 +946,89 @@ static int container_setup_workdir(struct hyper_container *container)
 	return 0;
 }
 
-static int hyper_rescan_scsi(void)
+/*
+ * Scan a single lun, addr is "target:lun" on host0 channel 0, the same
+ * layout hyper_find_sd() looks up. The kernel serializes scans of a host,
+ * so the luns are scanned one after another, each scan is a single
+ * INQUIRY instead of probing the whole bus.
+ */
+static int hyper_scan_scsi_addr(char *addr)
 {
-	struct dirent **list;
-	struct dirent *dir;
-	int fd = -1, i, num;
-	char path[256];
+	char path[512], scan[64];
+	unsigned target, lun;
 
-	num = scandir("/sys/class/scsi_host/", &list, NULL, NULL);
-	if (num < 0) {
-		perror("scan /sys/calss/virtio-ports/ failed");
+	if (sscanf(addr, "%u:%u", &target, &lun) != 2) {
+		fprintf(stderr, "invalid scsi address %s\n", addr);
 		return -1;
 	}
 
-	memset(path, 0, sizeof(path));
+	sprintf(path, "/sys/class/scsi_disk/0:0:%s", addr);
+	if (access(path, F_OK) == 0)
+		return 0;
 
-	for (i = 0; i < num; i++) {
-		dir = list[i];
-		if (dir->d_name[0] == '.')
-			continue;
+	sprintf(scan, "0 %u %u\n", target, lun);
+	fprintf(stdout, "scan scsi %s\n", addr);
+	return hyper_write_file("/sys/class/scsi_host/host0/scan", scan, strlen(scan));
+}
 
-		if (snprintf(path, sizeof(path), "/sys/class/scsi_host/%s/scan",
-			     dir->d_name) < 0) {
-			fprintf(stderr, "get scsi host device %s path failed\n",
-				dir->d_name);
-			continue;
-		}
+static int hyper_scan_scsi_disk(int ufd, char *addr, int wait)
+{
+	struct hyper_device dev = {
+		.type	= HYPER_DEV_SCSI,
+		.id	= addr,
+	};
 
-		fprintf(stdout, "path %s\n", path);
-		fd = open(path, O_WRONLY);
-		if (fd < 0) {
-			perror("open path failed");
-			continue;
-		}
+	if (!wait)
+		return hyper_scan_scsi_addr(addr);
 
-		if (write(fd, "- - - \n", 7) < 0)
-			perror("write to scan failed");
+	return hyper_uevent_wait_device(ufd, &dev, HYPER_DEVICE_TIMEOUT);
+}
 
-		close(fd);
+static int hyper_scan_container_disk(int ufd, struct hyper_container *c, int wait)
+{
+	int i;
+
+	if (c->scsiaddr && hyper_scan_scsi_disk(ufd, c->scsiaddr, wait) < 0)
+		return -1;
+
+	for (i = 0; i < c->vols_num; i++) {
+		if (c->vols[i].scsiaddr &&
+		    hyper_scan_scsi_disk(ufd, c->vols[i].scsiaddr, wait) < 0)
+			return -1;
 	}
 
-	fprintf(stdout, "finish scan scsi\n");
 	return 0;
-	free(list);
+}
+
+/*
+ * Discover the disks of container c, or of all containers of the pod if c
+ * is NULL, and wait until their block devices exist. Done in init once
+ * per pod operation, before the containers' rootfs are set up.
+ */
+int hyper_scan_container_disks(struct hyper_pod *pod, struct hyper_container *c)
+{
+	struct hyper_container *pos;
+	int ufd, ret = -1;
+
+	/* listen before scanning so no uevent is missed */
+	ufd = hyper_uevent_open();
+	if (ufd < 0)
+		return -1;
+
+	list_for_each_entry(pos, &pod->containers, list) {
+		if ((c == NULL || pos == c) && hyper_scan_container_disk(ufd, pos, 0) < 0)
+			goto out;
+	}
+
+	list_for_each_entry(pos, &pod->containers, list) {
+		if ((c == NULL || pos == c) && hyper_scan_container_disk(ufd, pos, 1) < 0)
+			goto out;
+	}
+
+	ret = 0;
+out:
+	close(ufd);
+	return ret;
 }
 
 struct hyper_container_arg {
@@ -533,11 +1057,6 @@ static int hyper_setup_container_rootfs(void *data)
 		goto fail;
 	}
 
-	if (hyper_rescan_scsi() < 0) {
-		fprintf(stdout, "rescan scsi failed\n");
-		goto fail;
-	}
-
 	if (mount("", "/", NULL, MS_SLAVE|MS_REC, NULL) < 0) {
 		perror("mount SLAVE failed");
 		goto fail;
@@ -560,13 +1079,12 @@ static int hyper_setup_container_rootfs(void *data)
 		char dev[128];
 		char *options = NULL;
 
-		if (container->scsiaddr) {
-			free(container->image);
-			container->image = NULL;
-			hyper_find_sd(container->scsiaddr, &container->image);
+		if (container_wait_device(container->scsiaddr, container->pciaddr,
+					  container->image, dev) < 0) {
+			fprintf(stderr, "container rootfs device is not ready\n");
+			goto fail;
 		}
 
-		sprintf(dev, "/dev/%s", container->image);
 		fprintf(stdout, "device %s\n", dev);
 
 		if (!strncmp(container->fstype, "xfs", strlen("xfs")))
@@ -582,7 +1100,7 @@ static int hyper_setup_container_rootfs(void *data)
 		sprintf(path, "/tmp/hyper/shared/%s/", container->image);
 		fprintf(stdout, "src directory %s\n", path);
 
-		if (mount(path, root, NULL, MS_BIND, NULL) < 0) {
+		if (hyper_bind_mount(path, root, 0) < 0) {
 			perror("mount src dir failed");
 			goto fail;
 		}
@@ -592,7 +1110,7 @@ static int hyper_setup_container_rootfs(void *data)
 		root, container->rootfs, container->exec.argv[0]);
 
 	sprintf(rootfs, "%s/%s/", root, container->rootfs);
-	if (mount(rootfs, rootfs, NULL, MS_BIND|MS_REC, NULL) < 0) {
+	if (hyper_bind_mount(rootfs, rootfs, HYPER_BIND_RECURSIVE) < 0) {
 		perror("failed to bind rootfs");
 		goto fail;
 	}
@@ -2,14 +2,24 @@
 #define _CONTAINER_H_
 
 #include "exec.h"
+#include "user.h"
 
 struct volume {
 	char	*device;
 	char	*scsiaddr;
+	char	*pciaddr;
 	char	*mountpoint;
 	char	*fstype;
 	int	readonly;
 	int	docker;
+	int	populate;
+};
+
+/* how a docker volume gets the image content, see container_setup_lazy_volume */
+enum {
+	POPULATE_COPY,
+	POPULATE_LAZY,
+	POPULATE_BACKGROUND,
 };
 
 struct fsmap {
@@ -35,12 +45,16 @@ struct hyper_container {
 	struct hyper_exec	exec;
 	int			ns;
 	uint32_t		code;
+	struct hyper_user_cache	*users;
+	struct hyper_exec_env	*env;
+	struct hyper_exec_path	*exec_paths;
 
 	// configs
 	char			*id;
 	char			*rootfs;
 	char			*image;
 	char			*scsiaddr;
+	char			*pciaddr;
 	char			*fstype;
 	struct volume		*vols;
 	struct fsmap		*maps;
@@ -55,6 +69,9 @@ struct hyper_container {
 
 struct hyper_pod;
 
+int hyper_setup_mount_template(struct hyper_pod *pod);
+void hyper_cleanup_mount_template(void);
+int hyper_scan_container_disks(struct hyper_pod *pod, struct hyper_container *c);
 int hyper_setup_container(struct hyper_container *container, struct hyper_pod *pod);
 struct hyper_container *hyper_find_container(struct hyper_pod *pod, const char *id);
 void hyper_cleanup_container(struct hyper_container *container, struct hyper_pod *pod);
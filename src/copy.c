@@ -0,0 +1,524 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/xattr.h>
+#include <linux/fs.h>
+
+#include "../config.h"
+#include "copy.h"
+#include "syscall.h"
+
+#ifndef FICLONE
+#define FICLONE		_IOW(0x94, 9, int)
+#endif
+
+/* trees with fewer regular files than this are copied by a single process */
+#define HYPER_COPY_PARALLEL_FILES	64
+#define HYPER_COPY_MAX_WORKERS		8
+
+struct hyper_copy_link {
+	dev_t	dev;
+	ino_t	ino;
+	char	*path;
+};
+
+struct hyper_copy {
+	int			src;
+	int			dst;
+	/* regular files, copied after the tree is created */
+	char			**files;
+	int			f_num;
+	/* directories, metadata applied last, deepest first */
+	char			**dirs;
+	int			d_num;
+	/* first path seen of every multi-linked inode */
+	struct hyper_copy_link	*inodes;
+	int			i_num;
+	/* later paths of a multi-linked inode, and the path to link to */
+	struct hyper_copy_link	*links;
+	int			l_num;
+};
+
+static int hyper_copy_append(void **array, int *num, size_t size, void *elem)
+{
+	void *new;
+
+	/* grow in power of two steps */
+	if ((*num & (*num - 1)) == 0) {
+		new = realloc(*array, (*num ? *num * 2 : 1) * size);
+		if (new == NULL) {
+			fprintf(stderr, "allocate copy list failed\n");
+			return -1;
+		}
+		*array = new;
+	}
+
+	memcpy((char *)*array + *num * size, elem, size);
+	(*num)++;
+	return 0;
+}
+
+static int hyper_copy_xattrs(int sfd, int dfd, const char *path)
+{
+	char *list = NULL, *name, *value = NULL;
+	ssize_t size, vsize;
+	int ret = -1;
+
+	size = flistxattr(sfd, NULL, 0);
+	if (size <= 0) {
+		/* no xattr or not supported by the source fs */
+		return 0;
+	}
+
+	list = malloc(size);
+	if (list == NULL)
+		goto out;
+
+	size = flistxattr(sfd, list, size);
+	if (size < 0)
+		goto out;
+
+	for (name = list; name < list + size; name += strlen(name) + 1) {
+		vsize = fgetxattr(sfd, name, NULL, 0);
+		if (vsize < 0)
+			continue;
+
+		free(value);
+		value = malloc(vsize + 1);
+		if (value == NULL)
+			goto out;
+
+		vsize = fgetxattr(sfd, name, value, vsize);
+		if (vsize < 0)
+			continue;
+
+		if (fsetxattr(dfd, name, value, vsize, 0) < 0 && errno != ENOTSUP)
+			fprintf(stderr, "set xattr %s of %s failed: %s\n",
+				name, path, strerror(errno));
+	}
+
+	ret = 0;
+out:
+	if (ret < 0)
+		fprintf(stderr, "copy xattrs of %s failed\n", path);
+	free(value);
+	free(list);
+	return ret;
+}
+
+/* ownership first, chown drops the suid/sgid bits set by chmod */
+static int hyper_copy_meta(int sfd, int dfd, struct stat *st, const char *path)
+{
+	struct timespec times[2] = { st->st_atim, st->st_mtim };
+
+	if (fchown(dfd, st->st_uid, st->st_gid) < 0 ||
+	    fchmod(dfd, st->st_mode & 07777) < 0) {
+		fprintf(stderr, "set owner/mode of %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (hyper_copy_xattrs(sfd, dfd, path) < 0)
+		return -1;
+
+	if (futimens(dfd, times) < 0) {
+		fprintf(stderr, "set times of %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int hyper_copy_data(int sfd, int dfd, off_t size)
+{
+	static int no_cfr;
+	char buf[65536];
+	ssize_t len, w, done;
+
+	/* reflink shares the extents, O(1) on btrfs/xfs */
+	if (ioctl(dfd, FICLONE, sfd) == 0)
+		return 0;
+
+	while (!no_cfr && size > 0) {
+		len = copy_file_range(sfd, NULL, dfd, NULL, size, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != ENOSYS && errno != EXDEV && errno != EINVAL &&
+			    errno != EOPNOTSUPP)
+				return -1;
+			/* cross fs on old kernels, fall back to read/write */
+			if (errno == ENOSYS)
+				no_cfr = 1;
+			break;
+		}
+		/* file shrunk while copying */
+		if (len == 0)
+			return 0;
+		size -= len;
+	}
+
+	if (size <= 0)
+		return 0;
+
+	for (;;) {
+		len = read(sfd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (len == 0)
+			return 0;
+
+		for (done = 0; done < len; done += w) {
+			w = write(dfd, buf + done, len - done);
+			if (w < 0) {
+				if (errno == EINTR) {
+					w = 0;
+					continue;
+				}
+				return -1;
+			}
+		}
+	}
+}
+
+/*
+ * Replace what is already at path in the destination, like tar did. The
+ * old file is unlinked rather than truncated so hard links to it elsewhere
+ * keep their content.
+ */
+static int hyper_copy_unlink(struct hyper_copy *cp, const char *path)
+{
+	if (unlinkat(cp->dst, path, 0) < 0 && errno != ENOENT) {
+		fprintf(stderr, "remove old %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int hyper_copy_file(struct hyper_copy *cp, const char *path)
+{
+	int sfd, dfd = -1, ret = -1;
+	struct stat st;
+
+	sfd = openat(cp->src, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (sfd < 0 || fstat(sfd, &st) < 0) {
+		fprintf(stderr, "open %s failed: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	if (hyper_copy_unlink(cp, path) < 0)
+		goto out;
+
+	dfd = openat(cp->dst, path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (dfd < 0) {
+		fprintf(stderr, "create %s failed: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	if (hyper_copy_data(sfd, dfd, st.st_size) < 0) {
+		fprintf(stderr, "copy data of %s failed: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	ret = hyper_copy_meta(sfd, dfd, &st, path);
+out:
+	if (sfd >= 0)
+		close(sfd);
+	if (dfd >= 0)
+		close(dfd);
+	return ret;
+}
+
+/* symlinks, devices, fifos and sockets, everything without data */
+static int hyper_copy_special(struct hyper_copy *cp, const char *path, struct stat *st)
+{
+	struct timespec times[2] = { st->st_atim, st->st_mtim };
+	char target[PATH_MAX];
+	ssize_t len;
+
+	if (hyper_copy_unlink(cp, path) < 0)
+		return -1;
+
+	if (S_ISLNK(st->st_mode)) {
+		len = readlinkat(cp->src, path, target, sizeof(target) - 1);
+		if (len < 0) {
+			fprintf(stderr, "readlink %s failed: %s\n", path, strerror(errno));
+			return -1;
+		}
+		target[len] = '\0';
+
+		if (symlinkat(target, cp->dst, path) < 0) {
+			fprintf(stderr, "symlink %s failed: %s\n", path, strerror(errno));
+			return -1;
+		}
+	} else if (mknodat(cp->dst, path, st->st_mode, st->st_rdev) < 0) {
+		fprintf(stderr, "mknod %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (fchownat(cp->dst, path, st->st_uid, st->st_gid, AT_SYMLINK_NOFOLLOW) < 0 ||
+	    (!S_ISLNK(st->st_mode) &&
+	     fchmodat(cp->dst, path, st->st_mode & 07777, 0) < 0) ||
+	    utimensat(cp->dst, path, times, AT_SYMLINK_NOFOLLOW) < 0) {
+		fprintf(stderr, "set metadata of %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static char *hyper_copy_path(const char *dir, const char *name)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/%s", dir, name) < 0) {
+		fprintf(stderr, "allocate path failed\n");
+		return NULL;
+	}
+
+	return path;
+}
+
+/*
+ * Create the directory tree and all non-regular files, and collect the
+ * regular files, hard links and directories for the later passes.
+ */
+static int hyper_copy_walk(struct hyper_copy *cp, const char *dir)
+{
+	struct hyper_copy_link link;
+	struct dirent *de;
+	struct stat st;
+	char *path;
+	int i, fd, ret = -1;
+	DIR *dp;
+
+	fd = openat(cp->src, dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0 || (dp = fdopendir(fd)) == NULL) {
+		fprintf(stderr, "open dir %s failed: %s\n", dir, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	while ((de = readdir(dp)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		path = hyper_copy_path(dir, de->d_name);
+		if (path == NULL)
+			goto out;
+
+		if (fstatat(cp->src, path, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+			fprintf(stderr, "stat %s failed: %s\n", path, strerror(errno));
+			goto fail;
+		}
+
+		if (S_ISDIR(st.st_mode)) {
+			/* writable until the final mode is applied */
+			if (mkdirat(cp->dst, path, 0700) < 0 && errno != EEXIST) {
+				fprintf(stderr, "mkdir %s failed: %s\n", path, strerror(errno));
+				goto fail;
+			}
+			if (hyper_copy_append((void **)&cp->dirs, &cp->d_num,
+					      sizeof(path), &path) < 0)
+				goto fail;
+			if (hyper_copy_walk(cp, path) < 0)
+				goto out;
+			continue;
+		}
+
+		if (!S_ISREG(st.st_mode)) {
+			if (hyper_copy_special(cp, path, &st) < 0)
+				goto fail;
+			free(path);
+			continue;
+		}
+
+		if (st.st_nlink > 1) {
+			for (i = 0; i < cp->i_num; i++) {
+				if (cp->inodes[i].dev == st.st_dev &&
+				    cp->inodes[i].ino == st.st_ino)
+					break;
+			}
+
+			link.dev = st.st_dev;
+			link.ino = st.st_ino;
+			link.path = path;
+			if (i < cp->i_num) {
+				/* link.dev/ino unused, remember the target index instead */
+				link.ino = i;
+				if (hyper_copy_append((void **)&cp->links, &cp->l_num,
+						      sizeof(link), &link) < 0)
+					goto fail;
+				continue;
+			}
+
+			if (hyper_copy_append((void **)&cp->inodes, &cp->i_num,
+					      sizeof(link), &link) < 0)
+				goto fail;
+		}
+
+		if (hyper_copy_append((void **)&cp->files, &cp->f_num,
+				      sizeof(path), &path) < 0)
+			goto fail;
+	}
+
+	ret = 0;
+out:
+	closedir(dp);
+	return ret;
+fail:
+	free(path);
+	goto out;
+}
+
+/* worker "id" of "num" copies every num-th file */
+static int hyper_copy_files(struct hyper_copy *cp, int id, int num)
+{
+	int i, ret = 0;
+
+	for (i = id; i < cp->f_num; i += num) {
+		if (hyper_copy_file(cp, cp->files[i]) < 0)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+static int hyper_copy_parallel(struct hyper_copy *cp)
+{
+	pid_t pids[HYPER_COPY_MAX_WORKERS];
+	int i, status, workers, ret = 0;
+
+	workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers > HYPER_COPY_MAX_WORKERS)
+		workers = HYPER_COPY_MAX_WORKERS;
+
+	if (workers <= 1 || cp->f_num < HYPER_COPY_PARALLEL_FILES)
+		return hyper_copy_files(cp, 0, 1);
+
+	for (i = 0; i < workers; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			perror("fork copy worker failed");
+			break;
+		} else if (pids[i] == 0) {
+			_exit(hyper_copy_files(cp, i, workers) < 0 ? 1 : 0);
+		}
+	}
+
+	/* a worker failed to start, copy its share here */
+	for (; i < workers; i++) {
+		pids[i] = -1;
+		if (hyper_copy_files(cp, i, workers) < 0)
+			ret = -1;
+	}
+
+	for (i = 0; i < workers; i++) {
+		if (pids[i] < 0)
+			continue;
+		if (waitpid(pids[i], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "copy worker %d failed\n", i);
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+static int hyper_copy_dir_meta(struct hyper_copy *cp, const char *path)
+{
+	int sfd, dfd = -1, ret = -1;
+	struct stat st;
+
+	sfd = openat(cp->src, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	dfd = openat(cp->dst, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (sfd < 0 || dfd < 0 || fstat(sfd, &st) < 0) {
+		fprintf(stderr, "open dir %s failed: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	ret = hyper_copy_meta(sfd, dfd, &st, path);
+out:
+	if (sfd >= 0)
+		close(sfd);
+	if (dfd >= 0)
+		close(dfd);
+	return ret;
+}
+
+/*
+ * Copy the content of src into the existing directory dst, preserving
+ * ownership, modes, times, xattrs and hard links, like
+ * `tar cf - -C src . | tar xf - -C dst` without forking a shell.
+ */
+int hyper_copy_dir(char *src, char *dst)
+{
+	struct hyper_copy cp;
+	int i, ret = -1;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.src = open(src, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	cp.dst = open(dst, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cp.src < 0 || cp.dst < 0) {
+		fprintf(stderr, "open %s or %s failed: %s\n", src, dst, strerror(errno));
+		goto out;
+	}
+
+	if (hyper_copy_walk(&cp, ".") < 0)
+		goto out;
+
+	fprintf(stdout, "copy %s to %s: %d dirs, %d files, %d links\n",
+		src, dst, cp.d_num, cp.f_num, cp.l_num);
+
+	if (hyper_copy_parallel(&cp) < 0)
+		goto out;
+
+	for (i = 0; i < cp.l_num; i++) {
+		if (hyper_copy_unlink(&cp, cp.links[i].path) < 0)
+			goto out;
+		if (linkat(cp.dst, cp.inodes[cp.links[i].ino].path,
+			   cp.dst, cp.links[i].path, 0) < 0) {
+			fprintf(stderr, "link %s failed: %s\n", cp.links[i].path, strerror(errno));
+			goto out;
+		}
+	}
+
+	/* children before parents, so the parents' mtime and mode stick */
+	for (i = cp.d_num - 1; i >= 0; i--) {
+		if (hyper_copy_dir_meta(&cp, cp.dirs[i]) < 0)
+			goto out;
+	}
+
+	ret = hyper_copy_dir_meta(&cp, ".");
+out:
+	if (cp.src >= 0)
+		close(cp.src);
+	if (cp.dst >= 0)
+		close(cp.dst);
+	for (i = 0; i < cp.f_num; i++)
+		free(cp.files[i]);
+	for (i = 0; i < cp.l_num; i++)
+		free(cp.links[i].path);
+	for (i = 0; i < cp.d_num; i++)
+		free(cp.dirs[i]);
+	free(cp.files);
+	free(cp.links);
+	free(cp.dirs);
+	free(cp.inodes);
+	return ret;
+}
@@ -0,0 +1,6 @@
+#ifndef _COPY_H_
+#define _COPY_H_
+
+int hyper_copy_dir(char *src, char *dst);
+
+#endif
@@ -17,18 +17,30 @@
 #include <inttypes.h>
 #include <grp.h>
 #include <pwd.h>
+#include <limits.h>
 
 #include "hyper.h"
 #include "util.h"
 #include "parse.h"
 #include "syscall.h"
+#include "user.h"
 
 static int hyper_release_exec(struct hyper_exec *, struct hyper_pod *);
-static void hyper_exec_process(struct hyper_exec *exec);
+
+/*
+ * All frames of an exec, its errseq stream included, go through the tty
+ * channel of its seq so the host sees them in order. hyperd hands out seqs
+ * sequentially, which spreads execs evenly over the channels.
+ */
+static struct hyper_event *hyper_tty_channel(uint64_t seq)
+{
+	return &ctl.tty[seq % ctl.ntty];
+}
 
 static int send_exec_finishing(uint64_t seq, int len, int code, int block)
 {
-	struct hyper_buf *buf = &ctl.tty.wbuf;
+	struct hyper_event *tty = hyper_tty_channel(seq);
+	struct hyper_buf *buf = &tty->wbuf;
 
 	if (buf->get + len > buf->size) {
 		uint8_t *data;
@@ -51,13 +63,13 @@ static int send_exec_finishing(uint64_t seq, int len, int code, int block)
 
 	buf->get += len;
 	if (!block) {
-		hyper_modify_event(ctl.efd, &ctl.tty, EPOLLIN | EPOLLOUT);
+		hyper_modify_event(ctl.efd, tty, EPOLLIN | EPOLLOUT);
 		return 0;
 	}
 
-	if (hyper_setfd_block(ctl.tty.fd) < 0 ||
-	    hyper_send_data(ctl.tty.fd, buf->data, buf->get) < 0 ||
-	    hyper_setfd_nonblock(ctl.tty.fd) < 0) {
+	if (hyper_setfd_block(tty->fd) < 0 ||
+	    hyper_send_data(tty->fd, buf->data, buf->get) < 0 ||
+	    hyper_setfd_nonblock(tty->fd) < 0) {
 		fprintf(stderr, "send eof failed\n");
 		return -1;
 	}
@@ -105,11 +117,38 @@ static void stderr_hup(struct hyper_event *de, int efd)
 	return pts_hup(de, efd, exec);
 }
 
-static int pts_loop(struct hyper_event *de, uint64_t seq, int efd, struct hyper_exec *exec)
+/*
+ * A stream out of output window leaves epoll until the host opens it again,
+ * so its pending data and hup wait in the kernel instead of busy looping.
+ */
+static void hyper_pause_stream(struct hyper_event *de)
+{
+	if (de->fd < 0 || de->flag == 0)
+		return;
+
+	fprintf(stdout, "%s fd %d\n", __func__, de->fd);
+	if (epoll_ctl(ctl.efd, EPOLL_CTL_DEL, de->fd, NULL) < 0)
+		perror("epoll_ctl del paused stream failed");
+	de->flag = 0;
+}
+
+static int hyper_resume_stream(struct hyper_event *de)
+{
+	if (de->fd < 0 || de->flag != 0)
+		return 0;
+
+	fprintf(stdout, "%s fd %d\n", __func__, de->fd);
+	return hyper_add_event(ctl.efd, de, EPOLLIN);
+}
+
+/* window is NULL for streams without flow control */
+static int pts_loop(struct hyper_event *de, uint64_t seq, int efd, struct hyper_exec *exec,
+		    uint32_t *window)
 {
 	int size = -1;
 	int flag = de->flag | EPOLLOUT;
-	struct hyper_buf *buf = &ctl.tty.wbuf;
+	struct hyper_event *tty = hyper_tty_channel(exec->seq);
+	struct hyper_buf *buf = &tty->wbuf;
 
 	if (FULL(buf)) {
 		flag |= EPOLLPRI;
@@ -117,7 +156,16 @@ static int pts_loop(struct hyper_event *de, uint64_t seq, int efd, struct hyper_
 	}
 
 	do {
-		size = read(de->fd, buf->data + buf->get + 12, buf->size - buf->get - 12);
+		uint32_t len = buf->size - buf->get - 12;
+
+		if (window) {
+			if (*window == 0)
+				break;
+			if (len > *window)
+				len = *window;
+		}
+
+		size = read(de->fd, buf->data + buf->get + 12, len);
 		fprintf(stdout, "%s: read %d data\n", __func__, size);
 		if (size < 0) {
 			if (errno == EINTR)
@@ -138,16 +186,20 @@ static int pts_loop(struct hyper_event *de, uint64_t seq, int efd, struct hyper_
 		hyper_set_be64(buf->data + buf->get, seq);
 		hyper_set_be32(buf->data + buf->get + 8, size + 12);
 		buf->get += size + 12;
+		if (window)
+			*window -= size;
 	} while (!FULL(buf));
 
-	if (FULL(buf)) {
+	if (window && *window == 0) {
+		hyper_pause_stream(de);
+	} else if (FULL(buf)) {
 		flag |= EPOLLPRI;
 		/* del & add event to move event to tail, this gives
 		 * other event a chance to write data to wbuf of tty. */
 		hyper_requeue_event(ctl.efd, de);
 	}
 out:
-	if (hyper_modify_event(ctl.efd, &ctl.tty, flag) < 0) {
+	if (hyper_modify_event(ctl.efd, tty, flag) < 0) {
 		fprintf(stderr, "modify ctl tty event to %d failed\n", flag);
 		return -1;
 	}
@@ -155,13 +207,171 @@ out:
 	return 0;
 }
 
+/* stdin buffers start at in_ops.wbuf_size and grow up to this */
+#define HYPER_STDIN_BUF_MAX	(1024 * 1024)
+/* credit a flow controlled exec may have outstanding, fits the buffer */
+#define HYPER_STDIN_WINDOW	(64 * 1024)
+/* output a flow controlled stream may send before the host opens more */
+#define HYPER_OUTPUT_WINDOW	(64 * 1024)
+
+/* returns 0 when the tty buffer has no room, the caller keeps the frame */
+static int hyper_send_tty_ctrl(uint8_t type, uint64_t seq, uint32_t value)
+{
+	struct hyper_event *tty = hyper_tty_channel(seq);
+	struct hyper_buf *buf = &tty->wbuf;
+
+	if (buf->get + TTY_CTRL_LEN > buf->size)
+		return 0;
+
+	hyper_set_be64(buf->data + buf->get, TTY_CTRL_SEQ);
+	hyper_set_be32(buf->data + buf->get + 8, TTY_CTRL_LEN);
+	buf->data[buf->get + 12] = type;
+	hyper_set_be64(buf->data + buf->get + 13, seq);
+	hyper_set_be32(buf->data + buf->get + 21, value);
+	buf->get += TTY_CTRL_LEN;
+
+	if (hyper_modify_event(ctl.efd, tty, EPOLLIN | EPOLLOUT) < 0)
+		return -1;
+
+	return 1;
+}
+
+/*
+ * Pending credit of an exec is one frame however many times stdin drained
+ * while the tty buffer was full, it goes out once the channel has room.
+ */
+static int hyper_send_stdin_credit(struct hyper_exec *exec)
+{
+	int ret;
+
+	if (exec->stdin_credit == 0)
+		return 0;
+
+	ret = hyper_send_tty_ctrl(TTY_CTRL_STDIN_CREDIT, exec->seq, exec->stdin_credit);
+	if (ret > 0)
+		exec->stdin_credit = 0;
+
+	return ret < 0 ? -1 : 0;
+}
+
+/* called after tty wrote some data out */
+void hyper_flush_tty_credits(struct hyper_pod *pod, struct hyper_event *tty)
+{
+	struct hyper_exec *exec;
+
+	list_for_each_entry(exec, &pod->exec_head, list) {
+		if (exec->stdin_credit == 0 || hyper_tty_channel(exec->seq) != tty)
+			continue;
+		if (hyper_send_stdin_credit(exec) < 0 || exec->stdin_credit > 0)
+			break;
+	}
+}
+
+/* called with a stdin frame of the host, len 0 is eof */
+int hyper_exec_queue_stdin(struct hyper_exec *exec, uint8_t *data, uint32_t len)
+{
+	struct hyper_buf *wbuf = &exec->stdinev.wbuf;
+
+	/* captured or stdio-less process */
+	if (exec->stdinev.fd < 0)
+		return 0;
+
+	if (len == 0) {
+		if (exec->tty)
+			return 0;
+		exec->close_stdin_request = 1;
+		/* we can't hup the stdinev here, force hup on next write */
+		goto out;
+	}
+
+	if (wbuf->size - wbuf->get < len && wbuf->size < HYPER_STDIN_BUF_MAX) {
+		uint32_t size = wbuf->size;
+		uint8_t *grow;
+
+		while (size - wbuf->get < len && size < HYPER_STDIN_BUF_MAX)
+			size *= 2;
+		if (size > HYPER_STDIN_BUF_MAX)
+			size = HYPER_STDIN_BUF_MAX;
+
+		grow = realloc(wbuf->data, size);
+		if (grow != NULL) {
+			wbuf->data = grow;
+			wbuf->size = size;
+		}
+	}
+
+	if (wbuf->size - wbuf->get < len) {
+		fprintf(stderr, "stdin of seq %" PRIu64 " full, drop %" PRIu32 " bytes\n",
+			exec->seq, len - (wbuf->size - wbuf->get));
+		len = wbuf->size - wbuf->get;
+	}
+
+	memcpy(wbuf->data + wbuf->get, data, len);
+	wbuf->get += len;
+out:
+	if (hyper_modify_event(ctl.efd, &exec->stdinev, EPOLLOUT) < 0) {
+		fprintf(stderr, "modify exec pts event to in & out failed\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* a control frame of the host on TTY_CTRL_SEQ */
+int hyper_handle_tty_ctrl(struct hyper_pod *pod, uint8_t *data, uint32_t len)
+{
+	struct hyper_exec *exec;
+	uint64_t seq;
+	uint32_t value;
+
+	if (len < TTY_CTRL_LEN - 12) {
+		fprintf(stderr, "tty control frame too short: %" PRIu32 "\n", len);
+		return 0;
+	}
+
+	seq = hyper_get_be64(data + 1);
+	value = hyper_get_be32(data + 9);
+
+	if (data[0] != TTY_CTRL_OUTPUT_WINDOW) {
+		fprintf(stderr, "unknown tty control frame type %" PRIu8 "\n", data[0]);
+		return 0;
+	}
+
+	list_for_each_entry(exec, &pod->exec_head, list) {
+		if (!exec->flow_control)
+			continue;
+
+		if (exec->seq == seq) {
+			exec->out_window += value;
+			if (hyper_resume_stream(&exec->stdoutev) < 0)
+				return -1;
+			if (exec->errseq == 0 && hyper_resume_stream(&exec->stderrev) < 0)
+				return -1;
+		} else if (exec->errseq == seq) {
+			exec->err_window += value;
+			if (hyper_resume_stream(&exec->stderrev) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
 static int write_to_stdin(struct hyper_event *de, int efd)
 {
 	struct hyper_exec *exec = container_of(de, struct hyper_exec, stdinev);
+	uint32_t queued = de->wbuf.get;
 	fprintf(stdout, "%s, seq %" PRIu64"\n", __func__, exec->seq);
 
 	int ret = hyper_event_write(de, efd);
 
+	/* give back what the process consumed, in batches */
+	if (ret >= 0 && exec->flow_control) {
+		exec->stdin_credit += queued - de->wbuf.get;
+		if (exec->stdin_credit >= HYPER_STDIN_WINDOW / 4 || de->wbuf.get == 0)
+			hyper_send_stdin_credit(exec);
+	}
+
 	if (ret >= 0 && de->wbuf.get == 0 && exec->close_stdin_request)
 		pts_hup(de, efd, exec);
 
@@ -179,7 +389,8 @@ static int stdout_loop(struct hyper_event *de, int efd)
 	struct hyper_exec *exec = container_of(de, struct hyper_exec, stdoutev);
 	fprintf(stdout, "%s, seq %" PRIu64"\n", __func__, exec->seq);
 
-	return pts_loop(de, exec->seq, efd, exec);
+	return pts_loop(de, exec->seq, efd, exec,
+			exec->flow_control ? &exec->out_window : NULL);
 }
 
 struct hyper_event_ops out_ops = {
@@ -194,7 +405,12 @@ static int stderr_loop(struct hyper_event *de, int efd)
 	struct hyper_exec *exec = container_of(de, struct hyper_exec, stderrev);
 	fprintf(stdout, "%s, seq %" PRIu64"\n", __func__, exec->errseq);
 
-	return pts_loop(de, exec->errseq ? exec->errseq : exec->seq, efd, exec);
+	if (exec->errseq == 0)
+		return pts_loop(de, exec->seq, efd, exec,
+				exec->flow_control ? &exec->out_window : NULL);
+
+	return pts_loop(de, exec->errseq, efd, exec,
+			exec->flow_control ? &exec->err_window : NULL);
 }
 
 struct hyper_event_ops err_ops = {
@@ -204,100 +420,460 @@ struct hyper_event_ops err_ops = {
 	/* don't need write buff, the stderr data is one way */
 };
 
-static int hyper_setup_exec_user(struct hyper_exec *exec)
+#define EXEC_CAPTURE_OUT_TRUNCATED	0x1
+#define EXEC_CAPTURE_ERR_TRUNCATED	0x2
+
+/*
+ * Keep up to exec->capture bytes of a captured stream, the rest is read
+ * and dropped so the process never blocks on a full pipe.
+ */
+static int capture_loop(struct hyper_event *de, int efd, struct hyper_exec *exec,
+			struct hyper_buf *buf, uint8_t truncated)
+{
+	uint8_t discard[4096];
+	int size;
+
+	for (;;) {
+		uint8_t *data = discard;
+		uint32_t len = sizeof(discard);
+
+		if (buf->get < exec->capture) {
+			if (buf->get == buf->size) {
+				uint32_t grow = buf->size ? buf->size * 2 : 4096;
+
+				if (grow > exec->capture)
+					grow = exec->capture;
+				data = realloc(buf->data, grow);
+				if (data == NULL) {
+					perror("grow capture buffer failed");
+					return -1;
+				}
+				buf->data = data;
+				buf->size = grow;
+			}
+			data = buf->data + buf->get;
+			len = buf->size - buf->get;
+		}
+
+		size = read(de->fd, data, len);
+		if (size < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN) {
+				perror("fail to read captured stream");
+				return -1;
+			}
+			return 0;
+		}
+		if (size == 0) { // eof
+			pts_hup(de, efd, exec);
+			return 0;
+		}
+
+		if (data == discard)
+			exec->truncated |= truncated;
+		else
+			buf->get += size;
+	}
+}
+
+static int capture_out_loop(struct hyper_event *de, int efd)
+{
+	struct hyper_exec *exec = container_of(de, struct hyper_exec, stdoutev);
+
+	return capture_loop(de, efd, exec, &exec->capout, EXEC_CAPTURE_OUT_TRUNCATED);
+}
+
+static int capture_err_loop(struct hyper_event *de, int efd)
+{
+	struct hyper_exec *exec = container_of(de, struct hyper_exec, stderrev);
+
+	return capture_loop(de, efd, exec, &exec->caperr, EXEC_CAPTURE_ERR_TRUNCATED);
+}
+
+struct hyper_event_ops capture_out_ops = {
+	.read		= capture_out_loop,
+	.hup		= stdout_hup,
+};
+
+struct hyper_event_ops capture_err_ops = {
+	.read		= capture_err_loop,
+	.hup		= stderr_hup,
+};
+
+/*
+ * EXECRESULT: seq (be64), exit code (be32), truncated flags (be32),
+ * stdout length (be32), stdout, stderr length (be32), stderr.
+ */
+static int hyper_send_exec_result(struct hyper_exec *exec)
+{
+	uint32_t outlen = exec->capout.get, errlen = exec->caperr.get;
+	uint32_t len = 24 + outlen + errlen;
+	uint8_t *data;
+	int ret;
+
+	data = malloc(len);
+	if (data == NULL) {
+		perror("allocate exec result failed");
+		return -1;
+	}
+
+	hyper_set_be64(data, exec->seq);
+	hyper_set_be32(data + 8, exec->code);
+	hyper_set_be32(data + 12, exec->truncated);
+	hyper_set_be32(data + 16, outlen);
+	if (outlen)
+		memcpy(data + 20, exec->capout.data, outlen);
+	hyper_set_be32(data + 20 + outlen, errlen);
+	if (errlen)
+		memcpy(data + 24 + outlen, exec->caperr.data, errlen);
+
+	ret = hyper_send_msg_block(ctl.chan.fd, EXECRESULT, len, data);
+	free(data);
+	return ret;
+}
+
+/*
+ * Everything the exec child needs, prepared by init before the clone. The
+ * child shares init's memory until it calls execve, so it must not
+ * allocate, use stdio or write anything but err and resolved. It reports
+ * errors with hyper_child_error().
+ */
+struct hyper_spawn {
+	struct hyper_exec	*exec;
+	struct hyper_container	*c;
+	int			utsns;
+	int			ipcns;
+	char			**envp;
+	char			*envbuf;
+	gid_t			*groups;
+	int			ngroups;
+	uid_t			uid;
+	gid_t			gid;
+	/* 1: switch to uid/gid/groups, -1: user lookup failed */
+	int			setuser;
+	int			err;
+	/* argv[0] found by an earlier exec, and the one execve is called with */
+	struct hyper_exec_path	*cached;
+	char			resolved[PATH_MAX];
+	struct stat		resolved_st;
+	/* the pts slave of a tty exec */
+	char			pts[32];
+};
+
+/* perror() for the exec child, only write(2) to its stderr and the stack */
+static void hyper_child_error(const char *msg)
+{
+	char num[16];
+	int err = errno, i = sizeof(num);
+
+	num[--i] = '\n';
+	do {
+		num[--i] = '0' + err % 10;
+		err /= 10;
+	} while (err > 0 && i > 0);
+
+	if (write(STDERR_FILENO, msg, strlen(msg)) < 0 ||
+	    write(STDERR_FILENO, ": errno ", 8) < 0 ||
+	    write(STDERR_FILENO, num + i, sizeof(num) - i) < 0)
+		return;
+}
+
+static struct hyper_pwent *hyper_prepare_exec_user(struct hyper_exec *exec,
+						   struct hyper_user_cache *users,
+						   struct hyper_spawn *sp)
 {
 	char *user = exec->user == NULL || strlen(exec->user) == 0 ? NULL : exec->user;
 	char *group = exec->group == NULL || strlen(exec->group) == 0 ? NULL : exec->group;
+	struct hyper_pwent *pwd;
+	int i;
+
+	sp->setuser = -1;
 
 	// check the config
 	if (!user) {
 		if (group || exec->nr_additional_groups > 0) {
 			fprintf(stderr, "group or additional groups can only be set when user is set\n");
-			return -1;
+			return NULL;
 		}
-		return 0;
+		sp->setuser = 0;
+		return NULL;
 	}
 
 	// get uid
 	fprintf(stdout, "try to find the user: %s\n", user);
-	struct passwd *pwd = hyper_getpwnam(user);
+	pwd = hyper_cache_getpwnam(users, user);
 	if (pwd == NULL) {
-		perror("can't find the user");
-		return -1;
+		fprintf(stderr, "can't find the user\n");
+		return NULL;
 	}
-	uid_t uid = pwd->pw_uid;
+	sp->uid = pwd->uid;
 
 	// get gid
-	gid_t gid = pwd->pw_gid;
+	sp->gid = pwd->gid;
 	if (group) {
 		fprintf(stdout, "try to find the group: %s\n", group);
-		struct group *gr = hyper_getgrnam(group);
+		struct hyper_grent *gr = hyper_cache_getgrnam(users, group);
 		if (gr == NULL) {
-			perror("can't find the group");
-			return -1;
+			fprintf(stderr, "can't find the group\n");
+			return NULL;
 		}
-		gid = gr->gr_gid;
+		sp->gid = gr->gid;
 	}
 
-	// get all gids
-	int i, ngroups = 10;
-	gid_t *reallocgroups, *groups = malloc(sizeof(gid_t) * ngroups);
-	if (groups == NULL)
-		goto fail;
-	if (hyper_getgrouplist(pwd->pw_name, gid, groups, &ngroups) < 0) {
-		reallocgroups = realloc(groups, sizeof(gid_t) * ngroups);
-		if (reallocgroups == NULL)
-			goto fail;
-		groups = reallocgroups;
-		if (hyper_getgrouplist(pwd->pw_name, gid, groups, &ngroups) < 0)
-			goto fail;
-	}
-	reallocgroups = realloc(groups, sizeof(gid_t) * (ngroups + exec->nr_additional_groups));
-	if (reallocgroups == NULL)
-		goto fail;
-	groups = reallocgroups;
+	// get all gids, the primary one only when the user is in no group
+	sp->ngroups = pwd->ngroups > 0 ? pwd->ngroups : 1;
+	sp->groups = malloc(sizeof(gid_t) * (sp->ngroups + exec->nr_additional_groups));
+	if (sp->groups == NULL)
+		return NULL;
+	if (pwd->ngroups > 0)
+		memcpy(sp->groups, pwd->groups, sizeof(gid_t) * sp->ngroups);
+	else
+		sp->groups[0] = sp->gid;
 	for (i = 0; i < exec->nr_additional_groups; i++) {
 		fprintf(stdout, "try to find the group: %s\n", exec->additional_groups[i]);
-		struct group *gr = hyper_getgrnam(exec->additional_groups[i]);
+		struct hyper_grent *gr = hyper_cache_getgrnam(users, exec->additional_groups[i]);
 		if (gr == NULL) {
-			perror("can't find the group");
-			goto fail;
+			fprintf(stderr, "can't find the group\n");
+			return NULL;
 		}
-		groups[ngroups] = gr->gr_gid;
-		ngroups++;
+		sp->groups[sp->ngroups++] = gr->gid;
 	}
 
-	// setup the owner of tty
-	if (exec->tty) {
-		char ptmx[512];
-		sprintf(ptmx, "/dev/pts/%d", exec->ptyno);
-		chown(ptmx, uid, gid);
+	sp->setuser = 1;
+	return pwd;
+}
+
+/*
+ * The environment every exec of a container starts from: init's environ,
+ * the container envs, HOME and HOSTNAME. Built on the first exec, the
+ * slots index envp by variable name so an exec only has to patch its own
+ * variables in.
+ */
+struct hyper_exec_env {
+	char		**envp;
+	int		num;
+	int		*slots;
+	unsigned int	mask;
+};
+
+static unsigned int hyper_env_hash(const char *name, size_t len)
+{
+	unsigned int hash = 5381;
+
+	while (len--)
+		hash = hash * 33 + (unsigned char)*name++;
+
+	return hash;
+}
+
+static int hyper_env_match(const char *env, const char *name, size_t len)
+{
+	return env != NULL && !strncmp(env, name, len) && env[len] == '=';
+}
+
+/* the slot of name in base, or of the empty slot it would go to */
+static int *hyper_env_slot(struct hyper_exec_env *base, const char *name, size_t len)
+{
+	unsigned int i = hyper_env_hash(name, len) & base->mask;
+
+	while (base->slots[i] >= 0 &&
+	       !hyper_env_match(base->envp[base->slots[i]], name, len))
+		i = (i + 1) & base->mask;
+
+	return &base->slots[i];
+}
+
+static int hyper_exec_env_set(struct hyper_exec_env *base, const char *name, const char *value)
+{
+	int *slot = hyper_env_slot(base, name, strlen(name));
+	char *env;
+
+	if (asprintf(&env, "%s=%s", name, value) < 0)
+		return -1;
+
+	if (*slot >= 0) {
+		free(base->envp[*slot]);
+	} else {
+		*slot = base->num++;
 	}
+	base->envp[*slot] = env;
 
-	// apply
-	if (setgroups(ngroups, groups) < 0) {
-		perror("setgroups() fails");
+	return 0;
+}
+
+void hyper_free_exec_env(struct hyper_exec_env *base)
+{
+	int i;
+
+	if (base == NULL)
+		return;
+
+	for (i = 0; i < base->num; i++)
+		free(base->envp[i]);
+	free(base->envp);
+	free(base->slots);
+	free(base);
+}
+
+static struct hyper_exec_env *hyper_new_exec_env(struct hyper_container *c, struct hyper_pod *pod)
+{
+	struct hyper_exec_env *base;
+	int i, max = 0, ret = 0;
+	unsigned int nslots = 16;
+
+	while (environ[max])
+		max++;
+	/* HOME, HOSTNAME and NULL */
+	max += c->exec.envs_num + 3;
+	while (nslots < max * 2)
+		nslots <<= 1;
+
+	base = calloc(1, sizeof(*base));
+	if (base == NULL)
+		return NULL;
+
+	base->mask = nslots - 1;
+	base->envp = calloc(max, sizeof(char *));
+	base->slots = malloc(nslots * sizeof(int));
+	if (base->envp == NULL || base->slots == NULL)
 		goto fail;
+	memset(base->slots, 0xff, nslots * sizeof(int));
+
+	for (i = 0; environ[i]; i++) {
+		char *eq = strchr(environ[i], '=');
+		int *slot;
+
+		if (eq == NULL)
+			continue;
+
+		slot = hyper_env_slot(base, environ[i], eq - environ[i]);
+		if (*slot >= 0)
+			continue;
+
+		base->envp[base->num] = strdup(environ[i]);
+		if (base->envp[base->num] == NULL)
+			goto fail;
+		*slot = base->num++;
 	}
-	if (setgid(gid) < 0) {
-		perror("setgid() fails");
+
+	/* TODO: merge container env to exec env in hyperd */
+	for (i = 0; i < c->exec.envs_num; i++)
+		ret |= hyper_exec_env_set(base, c->exec.envs[i].env, c->exec.envs[i].value);
+
+	// set early env. the container env config can overwrite it
+	ret |= hyper_exec_env_set(base, "HOME", "/root");
+	if (pod->hostname)
+		ret |= hyper_exec_env_set(base, "HOSTNAME", pod->hostname);
+
+	if (ret < 0)
 		goto fail;
+
+	return base;
+fail:
+	perror("fail to setup container env");
+	hyper_free_exec_env(base);
+	return NULL;
+}
+
+struct hyper_env_patch {
+	const char	*name;
+	const char	*value;
+};
+
+/*
+ * Patch the exec's variables over a copy of the container env. Only the
+ * pointer array and the patched strings are allocated, both are freed by
+ * the caller: the strings live in *buf.
+ */
+static char **hyper_build_exec_env(struct hyper_exec *exec, struct hyper_container *c,
+				   struct hyper_pod *pod, struct hyper_pwent *pwd,
+				   char **buf)
+{
+	struct hyper_exec_env *base;
+	struct hyper_env_patch *patch;
+	char **envp = NULL, *pos;
+	int i, j, num, npatch = 0, extra;
+	size_t size = 0;
+
+	*buf = NULL;
+	if (c->env == NULL) {
+		c->env = hyper_new_exec_env(c, pod);
+		if (c->env == NULL)
+			return NULL;
 	}
-	if (setuid(uid) < 0) {
-		perror("setuid() fails");
+	base = c->env;
+
+	patch = malloc((exec->envs_num + 3) * sizeof(*patch));
+	if (patch == NULL)
 		goto fail;
-	}
-	free(groups);
 
+	/* later patches win, the same order the setenv() calls used to have */
+	patch[npatch++] = (struct hyper_env_patch) { "TERM", exec->tty ? "xterm" : NULL };
 	// set user related envs. the container env config can overwrite it
-	setenv("USER", pwd->pw_name, 1);
-	setenv("HOME", pwd->pw_dir, 1);
+	if (pwd) {
+		patch[npatch++] = (struct hyper_env_patch) { "USER", pwd->name };
+		patch[npatch++] = (struct hyper_env_patch) { "HOME", pwd->dir };
+	}
+	for (i = 0; i < exec->envs_num; i++)
+		patch[npatch++] = (struct hyper_env_patch) { exec->envs[i].env, exec->envs[i].value };
 
-	return 0;
+	for (i = 0; i < npatch; i++) {
+		if (patch[i].value)
+			size += strlen(patch[i].name) + strlen(patch[i].value) + 2;
+	}
+
+	envp = malloc((base->num + npatch + 1) * sizeof(char *));
+	*buf = pos = malloc(size + 1);
+	if (envp == NULL || pos == NULL)
+		goto fail;
+
+	memcpy(envp, base->envp, base->num * sizeof(char *));
+	num = base->num;
+	extra = num;
 
+	for (i = 0; i < npatch; i++) {
+		size_t len = strlen(patch[i].name);
+		int *slot = hyper_env_slot(base, patch[i].name, len);
+		char *env = NULL;
+
+		if (patch[i].value) {
+			env = pos;
+			pos += sprintf(pos, "%s=%s", patch[i].name, patch[i].value) + 1;
+		}
+
+		if (*slot >= 0) {
+			envp[*slot] = env;
+			continue;
+		}
+
+		/* not in the container env, only a few of these */
+		for (j = extra; j < num; j++) {
+			if (hyper_env_match(envp[j], patch[i].name, len))
+				break;
+		}
+		if (j < num)
+			envp[j] = env;
+		else if (env)
+			envp[num++] = env;
+	}
+
+	/* drop unset variables */
+	for (i = 0, j = 0; i < num; i++) {
+		if (envp[i])
+			envp[j++] = envp[i];
+	}
+	envp[j] = NULL;
+
+	free(patch);
+	return envp;
 fail:
-	free(groups);
-	return -1;
+	perror("fail to setup env");
+	free(patch);
+	free(envp);
+	free(*buf);
+	*buf = NULL;
+	return NULL;
 }
 
 static int hyper_setup_exec_notty(struct hyper_exec *e)
@@ -412,45 +988,45 @@ static int hyper_setup_exec_tty(struct hyper_exec *e)
 	return 0;
 }
 
-static int hyper_dup_exec_tty(struct hyper_exec *e)
+/* runs in the exec child, see struct hyper_spawn */
+static int hyper_dup_exec_tty(struct hyper_spawn *sp)
 {
+	struct hyper_exec *e = sp->exec;
+	int stdinfd = e->stdinfd, stdoutfd = e->stdoutfd, stderrfd = e->stderrfd;
 	int ret = -1;
 
-	fprintf(stdout, "%s\n", __func__);
 	setsid();
 
 	if (e->tty) {
-		char ptmx[512];
-		sprintf(ptmx, "/dev/pts/%d", e->ptyno);
+		int ptyfd;
+
 		// reopen slave ptyfd for correcting the symlink path of the /dev/fd/1
-		e->ptyfd = open(ptmx, O_RDWR | O_CLOEXEC);
-		if (e->ptyfd < 0 || ioctl(e->ptyfd, TIOCSCTTY, NULL) < 0) {
-			perror("ioctl pty device for execcmd failed");
+		ptyfd = open(sp->pts, O_RDWR | O_CLOEXEC);
+		if (ptyfd < 0 || ioctl(ptyfd, TIOCSCTTY, NULL) < 0) {
+			hyper_child_error("ioctl pty device for execcmd failed");
 			goto out;
 		}
-		e->stdinfd = e->ptyfd;
-		e->stdoutfd = e->ptyfd;
+		stdinfd = ptyfd;
+		stdoutfd = ptyfd;
 		if (e->errseq == 0)
-			e->stderrfd = e->ptyfd;
+			stderrfd = ptyfd;
 		close(e->stdinev.fd);
 		close(e->stdoutev.fd);
 		close(e->stderrev.fd);
 	}
 
-	fflush(stdout);
-
-	if (dup2(e->stdinfd, STDIN_FILENO) < 0) {
-		perror("dup tty device to stdin failed");
+	if (dup2(stdinfd, STDIN_FILENO) < 0) {
+		hyper_child_error("dup tty device to stdin failed");
 		goto out;
 	}
 
-	if (dup2(e->stdoutfd, STDOUT_FILENO) < 0) {
-		perror("dup tty device to stdout failed");
+	if (dup2(stdoutfd, STDOUT_FILENO) < 0) {
+		hyper_child_error("dup tty device to stdout failed");
 		goto out;
 	}
 
-	if (dup2(e->stderrfd, STDERR_FILENO) < 0) {
-		perror("dup err pipe to stderr failed");
+	if (dup2(stderrfd, STDERR_FILENO) < 0) {
+		hyper_child_error("dup err pipe to stderr failed");
 		goto out;
 	}
 
@@ -459,6 +1035,28 @@ out:
 	return ret;
 }
 
+/* captured execs get no stdin and keep their output off the tty channel */
+static int hyper_watch_exec_capture(struct hyper_exec *exec, struct hyper_pod *pod)
+{
+	close(exec->stdinev.fd);
+	exec->stdinev.fd = -1;
+
+	if (hyper_init_event(&exec->stdoutev, &capture_out_ops, pod) < 0 ||
+	    hyper_add_event(ctl.efd, &exec->stdoutev, EPOLLIN) < 0) {
+		fprintf(stderr, "add captured stdout event failed\n");
+		return -1;
+	}
+	exec->ref++;
+
+	if (hyper_init_event(&exec->stderrev, &capture_err_ops, pod) < 0 ||
+	    hyper_add_event(ctl.efd, &exec->stderrev, EPOLLIN) < 0) {
+		fprintf(stderr, "add captured stderr event failed\n");
+		return -1;
+	}
+	exec->ref++;
+	return 0;
+}
+
 static int hyper_watch_exec_pty(struct hyper_exec *exec, struct hyper_pod *pod)
 {
 	fprintf(stdout, "hyper_init_event container pts event %p, ops %p, fd %d\n",
@@ -467,6 +1065,9 @@ static int hyper_watch_exec_pty(struct hyper_exec *exec, struct hyper_pod *pod)
 	if (exec->seq == 0)
 		return 0;
 
+	if (exec->capture)
+		return hyper_watch_exec_capture(exec, pod);
+
 	if (hyper_init_event(&exec->stdinev, &in_ops, pod) < 0 ||
 	    hyper_add_event(ctl.efd, &exec->stdinev, EPOLLOUT) < 0) {
 		fprintf(stderr, "add container stdin event failed\n");
@@ -474,6 +1075,15 @@ static int hyper_watch_exec_pty(struct hyper_exec *exec, struct hyper_pod *pod)
 	}
 	exec->ref++;
 
+	exec->out_window = HYPER_OUTPUT_WINDOW;
+	exec->err_window = HYPER_OUTPUT_WINDOW;
+	if (exec->flow_control)
+		exec->stdin_credit = HYPER_STDIN_WINDOW;
+	if (hyper_send_stdin_credit(exec) < 0) {
+		fprintf(stderr, "grant stdin credit failed\n");
+		return -1;
+	}
+
 	if (hyper_init_event(&exec->stdoutev, &out_ops, pod) < 0 ||
 	    hyper_add_event(ctl.efd, &exec->stdoutev, EPOLLIN) < 0) {
 		fprintf(stderr, "add container stdout event failed\n");
@@ -490,90 +1100,309 @@ static int hyper_watch_exec_pty(struct hyper_exec *exec, struct hyper_pod *pod)
 	return 0;
 }
 
-static int hyper_do_exec_cmd(struct hyper_exec *exec, struct hyper_pod *pod, int pipe)
+#define HYPER_EXEC_PATHS_MAX	64
+
+/* resolved argv[0] of the execs of a container, most recent first */
+struct hyper_exec_path {
+	struct hyper_exec_path	*next;
+	char			*name;
+	/* the PATH it was found in */
+	char			*search;
+	char			*path;
+	dev_t			dev;
+	ino_t			ino;
+	struct timespec		mtime;
+};
+
+static void hyper_free_exec_path(struct hyper_exec_path *ep)
+{
+	free(ep->name);
+	free(ep->search);
+	free(ep->path);
+	free(ep);
+}
+
+void hyper_free_exec_paths(struct hyper_exec_path *ep)
+{
+	struct hyper_exec_path *next;
+
+	for (; ep; ep = next) {
+		next = ep->next;
+		hyper_free_exec_path(ep);
+	}
+}
+
+static const char *hyper_envp_get(char **envp, const char *name)
+{
+	size_t len = strlen(name);
+
+	for (; *envp; envp++) {
+		if (!strncmp(*envp, name, len) && (*envp)[len] == '=')
+			return *envp + len + 1;
+	}
+
+	return NULL;
+}
+
+static struct hyper_exec_path *hyper_find_exec_path(struct hyper_container *c,
+						    const char *name, const char *search)
+{
+	struct hyper_exec_path *ep;
+
+	for (ep = c->exec_paths; ep; ep = ep->next) {
+		if (!strcmp(ep->name, name) && !strcmp(ep->search, search))
+			return ep;
+	}
+
+	return NULL;
+}
+
+static void hyper_remember_exec_path(struct hyper_container *c, const char *name,
+				     const char *search, struct hyper_spawn *sp)
+{
+	struct hyper_exec_path *ep, **pp;
+	char *path;
+	int num = 0;
+
+	ep = hyper_find_exec_path(c, name, search);
+	if (ep == NULL) {
+		ep = calloc(1, sizeof(*ep));
+		if (ep == NULL)
+			return;
+		ep->name = strdup(name);
+		ep->search = strdup(search);
+		if (ep->name == NULL || ep->search == NULL) {
+			hyper_free_exec_path(ep);
+			return;
+		}
+	} else {
+		for (pp = &c->exec_paths; *pp != ep; pp = &(*pp)->next);
+		*pp = ep->next;
+	}
+
+	if (ep->path == NULL || strcmp(ep->path, sp->resolved)) {
+		path = strdup(sp->resolved);
+		if (path == NULL) {
+			hyper_free_exec_path(ep);
+			return;
+		}
+		free(ep->path);
+		ep->path = path;
+	}
+	ep->dev = sp->resolved_st.st_dev;
+	ep->ino = sp->resolved_st.st_ino;
+	ep->mtime = sp->resolved_st.st_mtim;
+
+	ep->next = c->exec_paths;
+	c->exec_paths = ep;
+
+	for (pp = &c->exec_paths; *pp; pp = &(*pp)->next) {
+		if (++num > HYPER_EXEC_PATHS_MAX) {
+			hyper_free_exec_paths(*pp);
+			*pp = NULL;
+			break;
+		}
+	}
+}
+
+static int hyper_flush_exec_paths(struct hyper_container *c)
+{
+	hyper_free_exec_paths(c->exec_paths);
+	c->exec_paths = NULL;
+	return 0;
+}
+
+/* FLUSHEXECCACHE {"container": id}, all containers without an id */
+int hyper_cmd_flush_exec_cache(char *json, int length)
 {
+	struct hyper_pod *pod = &global_pod;
 	struct hyper_container *c;
+	JSON_Value *value = NULL;
+	const char *id = NULL;
+	int ret = -1;
 
-	if (hyper_enter_sandbox(pod, pipe) < 0) {
-		perror("enter pidns of pod init failed");
-		hyper_send_type(pipe, -1);
+	if (length > 0) {
+		value = hyper_json_parse(json, length);
+		if (value == NULL)
+			return -1;
+		id = json_object_get_string(json_object(value), "container");
+	}
+
+	if (id == NULL) {
+		list_for_each_entry(c, &pod->containers, list)
+			hyper_flush_exec_paths(c);
+		ret = 0;
 		goto out;
 	}
 
-	c = hyper_find_container(pod, exec->id);
+	c = hyper_find_container(pod, id);
 	if (c == NULL) {
-		fprintf(stderr, "can not find container %s\n", exec->id);
+		fprintf(stderr, "can not find container whose id is %s\n", id);
 		goto out;
 	}
 
-	if (setns(c->ns, CLONE_NEWNS) < 0) {
-		perror("fail to enter container ns");
-		goto out;
+	ret = hyper_flush_exec_paths(c);
+out:
+	json_value_free(value);
+	return ret;
+}
+
+/* record path as the one argv[0] resolved to, then execve it */
+static void hyper_try_exec(struct hyper_spawn *sp, const char *path, struct stat *st,
+			   char **argv, char **envp)
+{
+	int argc;
+
+	strcpy(sp->resolved, path);
+	sp->resolved_st = *st;
+	execve(path, argv, envp);
+
+	if (errno == ENOEXEC) {
+		for (argc = 0; argv[argc]; argc++);
+		char *sh_argv[argc + 2];
+
+		sh_argv[0] = "/bin/sh";
+		sh_argv[1] = (char *)path;
+		memcpy(sh_argv + 2, argv + 1, argc * sizeof(char *));
+		execve(sh_argv[0], sh_argv, envp);
 	}
-	chdir("/");
 
-	/* TODO: merge container env to exec env in hyperd */
-	if (hyper_setup_env(c->exec.envs, c->exec.envs_num) < 0) {
-		fprintf(stderr, "setup container envs for exec failed\n");
-		goto out;
+	sp->resolved[0] = '\0';
+}
+
+/*
+ * execvpe() with the PATH of envp instead of the one of init. An earlier
+ * result still at the same inode and mtime is exec'ed without searching,
+ * so misses only cost a stat() each. Only uses the stack, see struct
+ * hyper_spawn.
+ */
+static void hyper_execvpe(struct hyper_spawn *sp, const char *file, char **argv, char **envp)
+{
+	struct hyper_exec_path *ep = sp->cached;
+	const char *path = "/bin:/usr/bin", *p, *end;
+	char buf[PATH_MAX];
+	struct stat st;
+	int eacces = 0;
+
+	if (strchr(file, '/')) {
+		execve(file, argv, envp);
+		return;
 	}
 
-	// set early env. the container env config can overwrite it
-	setenv("HOME", "/root", 1);
-	setenv("HOSTNAME", pod->hostname, 1);
-	if (exec->tty)
-		setenv("TERM", "xterm", 1);
-	else
-		unsetenv("TERM");
+	if (ep && stat(ep->path, &st) == 0 &&
+	    st.st_dev == ep->dev && st.st_ino == ep->ino &&
+	    st.st_mtim.tv_sec == ep->mtime.tv_sec &&
+	    st.st_mtim.tv_nsec == ep->mtime.tv_nsec)
+		hyper_try_exec(sp, ep->path, &st, argv, envp);
+
+	p = hyper_envp_get(envp, "PATH");
+	if (p != NULL)
+		path = p;
+
+	for (p = path; ; p = end + 1) {
+		size_t len;
+
+		end = strchrnul(p, ':');
+		len = end - p;
+		if (len + 1 + strlen(file) >= sizeof(buf))
+			goto next;
+		memcpy(buf, p, len);
+		if (len)
+			buf[len++] = '/';
+		strcpy(buf + len, file);
+
+		if (stat(buf, &st) < 0) {
+			if (errno == EACCES)
+				eacces = 1;
+			else if (errno != ENOENT && errno != ENOTDIR &&
+				 errno != ESTALE && errno != ENODEV &&
+				 errno != ETIMEDOUT)
+				return;
+			goto next;
+		}
 
-	hyper_exec_process(exec);
+		if (!S_ISREG(st.st_mode)) {
+			eacces = 1;
+			goto next;
+		}
 
-out:
-	_exit(125);
+		hyper_try_exec(sp, buf, &st, argv, envp);
+		if (errno == EACCES)
+			eacces = 1;
+		else if (errno != ENOENT && errno != ENOTDIR &&
+			 errno != ESTALE && errno != ENODEV &&
+			 errno != ETIMEDOUT)
+			return;
+next:
+		if (*end == '\0')
+			break;
+	}
+
+	errno = eacces ? EACCES : ENOENT;
 }
 
-// do the exec, no return
-static void hyper_exec_process(struct hyper_exec *exec)
+// do the exec in the container, no return
+static int hyper_exec_child(void *data)
 {
-	if (sigprocmask(SIG_SETMASK, &orig_mask, NULL) < 0) {
-		perror("sigprocmask restore mask failed");
-		goto exit;
+	struct hyper_spawn *sp = data;
+	struct hyper_exec *exec = sp->exec;
+
+	/* the pidns was entered by init for us */
+	if (setns(sp->utsns, CLONE_NEWUTS) < 0 ||
+	    setns(sp->ipcns, CLONE_NEWIPC) < 0 ||
+	    setns(sp->c->ns, CLONE_NEWNS) < 0) {
+		sp->err = errno;
+		_exit(125);
 	}
+	chdir("/");
 
 	if (exec->workdir && chdir(exec->workdir) < 0) {
-		perror("change work directory failed");
+		hyper_child_error("change work directory failed");
 		goto exit;
 	}
 
-	if (hyper_setup_exec_user(exec) < 0) {
-		fprintf(stderr, "setup exec user failed\n");
+	if (sp->setuser < 0) {
+		errno = EINVAL;
+		hyper_child_error("setup exec user failed");
 		goto exit;
+	} else if (sp->setuser) {
+		// setup the owner of tty
+		if (exec->tty)
+			chown(sp->pts, sp->uid, sp->gid);
+
+		if (setgroups(sp->ngroups, sp->groups) < 0) {
+			hyper_child_error("setgroups() fails");
+			goto exit;
+		}
+		if (setgid(sp->gid) < 0) {
+			hyper_child_error("setgid() fails");
+			goto exit;
+		}
+		if (setuid(sp->uid) < 0) {
+			hyper_child_error("setuid() fails");
+			goto exit;
+		}
 	}
 
-	// set the process env
-	if (hyper_setup_env(exec->envs, exec->envs_num) < 0) {
-		fprintf(stderr, "setup env failed\n");
+	if (hyper_dup_exec_tty(sp) < 0)
 		goto exit;
-	}
 
-	if (hyper_dup_exec_tty(exec) < 0) {
-		fprintf(stderr, "dup pts to exec stdio failed\n");
+	if (sigprocmask(SIG_SETMASK, &orig_mask, NULL) < 0) {
+		hyper_child_error("sigprocmask restore mask failed");
 		goto exit;
 	}
 
-	if (execvp(exec->argv[0], exec->argv) < 0) {
-		perror("exec failed");
+	hyper_execvpe(sp, exec->argv[0], exec->argv, sp->envp);
+	hyper_child_error("exec failed");
 
-		 /* the exit codes follow the `chroot` standard,
-		    see docker/docs/reference/run.md#exit-status */
-		if (errno == ENOENT)
-			_exit(127);
-		else if (errno == EACCES)
-			_exit(126);
-	}
+	/* the exit codes follow the `chroot` standard,
+	   see docker/docs/reference/run.md#exit-status */
+	if (errno == ENOENT)
+		_exit(127);
+	else if (errno == EACCES)
+		_exit(126);
 
 exit:
-	fflush(stdout);
 	_exit(125);
 }
 
@@ -589,6 +1418,8 @@ static void hyper_free_exec(struct hyper_exec *exec)
 	}
 
 	free(exec->argv);
+	free(exec->capout.data);
+	free(exec->caperr.data);
 	free(exec);
 }
 
@@ -611,12 +1442,110 @@ int hyper_exec_cmd(char *json, int length)
 	return ret;
 }
 
+/*
+ * EXECBATCH {"execs": [execcmd, ...]}: spawn the processes back to back and
+ * reply [{"index": i, "seq": seq, "pid": pid | "error": msg}, ...] in
+ * request order. One failing process doesn't stop the others.
+ */
+int hyper_cmd_exec_batch(char *json, int length, uint32_t *datalen, uint8_t **data)
+{
+	struct hyper_exec **execs = NULL;
+	JSON_Value *value = NULL;
+	JSON_Array *array;
+	char *str;
+	int i, num, ret = -1;
+
+	fprintf(stdout, "call hyper_cmd_exec_batch, json %s, len %d\n", json, length);
+
+	num = hyper_parse_execcmds(json, length, &execs);
+	if (num < 0) {
+		fprintf(stderr, "parse exec batch failed\n");
+		return -1;
+	}
+
+	value = json_value_init_array();
+	if (value == NULL)
+		goto out;
+	array = json_array(value);
+
+	for (i = 0; i < num; i++) {
+		struct hyper_exec *exec = execs[i];
+		JSON_Value *item = json_value_init_object();
+		JSON_Object *obj = json_object(item);
+
+		if (item == NULL || json_array_append_value(array, item) != JSONSuccess) {
+			json_value_free(item);
+			goto out;
+		}
+
+		json_object_set_number(obj, "index", i);
+		if (exec == NULL) {
+			json_object_set_string(obj, "error", "parse execcmd failed");
+			continue;
+		}
+
+		json_object_set_number(obj, "seq", exec->seq);
+		if (hyper_run_process(exec) < 0) {
+			json_object_set_string(obj, "error", "start process failed");
+			continue;
+		}
+
+		/* owned by the pod now */
+		execs[i] = NULL;
+		json_object_set_number(obj, "pid", exec->pid);
+	}
+
+	str = json_serialize_to_string(value);
+	if (str == NULL) {
+		fprintf(stderr, "serialize exec batch result failed\n");
+		goto out;
+	}
+
+	*data = (uint8_t *)str;
+	*datalen = strlen(str);
+	ret = 0;
+out:
+	for (i = 0; i < num; i++) {
+		if (execs[i])
+			hyper_free_exec(execs[i]);
+	}
+	free(execs);
+	json_value_free(value);
+	return ret;
+}
+
+int hyper_signal_exec(struct hyper_exec *exec, int sig)
+{
+	if (exec->pidfd >= 0) {
+		if (pidfd_send_signal(exec->pidfd, sig, NULL, 0) == 0)
+			return 0;
+		/* the pid may already be reused when the pidfd says it's gone */
+		if (errno != ENOSYS)
+			return -1;
+	}
+
+	return kill(exec->pid, sig);
+}
+
+/*
+ * Spawn the exec with clone(CLONE_VM|CLONE_VFORK) straight into the pod
+ * pidns, so init's address space is never copied. init switches its pidns
+ * for children around the clone, the child joins the other namespaces.
+ */
 int hyper_run_process(struct hyper_exec *exec)
 {
+	static int init_pidns = -1;
 	struct hyper_pod *pod = &global_pod;
-	int pipe[2] = {-1, -1};
+	struct hyper_spawn sp = {
+		.exec	= exec,
+		.utsns	= pod->utsns,
+		.ipcns	= pod->ipcns,
+	};
+	struct hyper_pwent *pwd;
+	const char *search;
+	int stacksize = getpagesize() * 16;
 	int pid, ret = -1;
-	uint32_t type;
+	void *stack = NULL;
 
 	if (exec->argv == NULL) {
 		fprintf(stderr, "cmd is %p, seq %" PRIu64 ", container %s\n",
@@ -624,10 +1553,52 @@ int hyper_run_process(struct hyper_exec *exec)
 		goto out;
 	}
 
+	if (exec->capture && (exec->tty || exec->init)) {
+		fprintf(stderr, "capture only works for execs without terminal\n");
+		goto out;
+	}
+
+	sp.c = hyper_find_container(pod, exec->id);
+	if (sp.c == NULL) {
+		fprintf(stderr, "can not find container %s\n", exec->id);
+		goto out;
+	}
+
+	/* the child looks users up in init's cache */
+	if (exec->user != NULL && strlen(exec->user) > 0 &&
+	    hyper_refresh_user_cache(&sp.c->users, sp.c->ns) < 0)
+		fprintf(stderr, "load users of container %s failed\n", sp.c->id);
+
+	pwd = hyper_prepare_exec_user(exec, sp.c->users, &sp);
+	sp.envp = hyper_build_exec_env(exec, sp.c, pod, pwd, &sp.envbuf);
+	if (sp.envp == NULL)
+		goto out;
+
+	search = hyper_envp_get(sp.envp, "PATH");
+	if (search == NULL)
+		search = "";
+	sp.cached = hyper_find_exec_path(sp.c, exec->argv[0], search);
+
+	if (init_pidns < 0) {
+		init_pidns = open("/proc/self/ns/pid", O_RDONLY| O_CLOEXEC);
+		if (init_pidns < 0) {
+			perror("open pidns of hyper init failed");
+			goto out;
+		}
+	}
+
+	stack = malloc(stacksize);
+	if (stack == NULL) {
+		perror("fail to allocate stack for exec");
+		goto out;
+	}
+
 	if (hyper_setup_exec_tty(exec) < 0) {
 		fprintf(stderr, "setup exec tty failed\n");
 		goto out;
 	}
+	if (exec->tty)
+		snprintf(sp.pts, sizeof(sp.pts), "/dev/pts/%d", exec->ptyno);
 
 	if (hyper_watch_exec_pty(exec, pod) < 0) {
 		fprintf(stderr, "add pts master event failed\n");
@@ -637,31 +1608,49 @@ int hyper_run_process(struct hyper_exec *exec)
 	list_add_tail(&exec->list, &pod->exec_head);
 	exec->ref++;
 
-	if (pipe2(pipe, O_CLOEXEC) < 0) {
-		perror("create pipe between pod init execcmd failed");
+	if (setns(pod->pidns, CLONE_NEWPID) < 0) {
+		perror("enter pidns of pod init failed");
 		goto close_tty;
 	}
 
-	pid = fork();
+	/* the child must not flush init's stdio buffers */
+	fflush(stdout);
+	fflush(stderr);
+	exec->pidfd = -1;
+	pid = clone(hyper_exec_child, stack + stacksize,
+		    CLONE_VM| CLONE_VFORK| CLONE_PIDFD| SIGCHLD, &sp, &exec->pidfd);
+	if (pid < 0 && errno == EINVAL) {
+		/* kernel before 5.2 */
+		exec->pidfd = -1;
+		pid = clone(hyper_exec_child, stack + stacksize,
+			    CLONE_VM| CLONE_VFORK| SIGCHLD, &sp);
+	}
+
+	if (setns(init_pidns, CLONE_NEWPID) < 0)
+		perror("back to pidns of hyper init failed");
+
 	if (pid < 0) {
-		perror("clone hyper_do_exec_cmd failed");
+		perror("clone exec process failed");
 		goto close_tty;
-	} else if (pid == 0) {
-		hyper_do_exec_cmd(exec, pod, pipe[1]);
 	}
-	fprintf(stdout, "do_exec_cmd pid %d\n", pid);
 
-	if (hyper_get_type(pipe[0], &type) < 0 || (int)type < 0) {
-		fprintf(stderr, "hyper init doesn't get execcmd ready message\n");
+	if (sp.err) {
+		fprintf(stderr, "exec process fail to enter the sandbox: %s\n",
+			strerror(sp.err));
 		goto close_tty;
 	}
-	exec->pid = type;
 
-	fprintf(stdout, "%s get ready message %"PRIu32 "\n", __func__, type);
+	if (sp.resolved[0] && !strchr(exec->argv[0], '/'))
+		hyper_remember_exec_path(sp.c, exec->argv[0], search, &sp);
+
+	exec->pid = pid;
+	fprintf(stdout, "%s exec pid %d\n", __func__, pid);
 	ret = 0;
 out:
-	close(pipe[0]);
-	close(pipe[1]);
+	free(stack);
+	free(sp.groups);
+	free(sp.envp);
+	free(sp.envbuf);
 	return ret;
 close_tty:
 	hyper_reset_event(&exec->stdinev);
@@ -673,6 +1662,8 @@ close_tty:
 	close(exec->stdinfd);
 	close(exec->stdoutfd);
 	close(exec->stderrfd);
+	close(exec->pidfd);
+	exec->pidfd = -1;
 	goto out;
 }
 
@@ -716,9 +1707,13 @@ static int hyper_release_exec(struct hyper_exec *exec,
 
 	list_del_init(&exec->list);
 
-	hyper_send_exec_eof(exec, 0);
-
-	hyper_send_exec_code(exec, 0);
+	if (exec->capture) {
+		if (hyper_send_exec_result(exec) < 0)
+			fprintf(stderr, "send exec result failed\n");
+	} else {
+		hyper_send_exec_eof(exec, 0);
+		hyper_send_exec_code(exec, 0);
+	}
 
 	fprintf(stdout, "%s exit code %" PRIu8"\n", __func__, exec->code);
 	if (exec->init) {
@@ -856,6 +1851,8 @@ int hyper_handle_exec_exit(struct hyper_pod *pod, int pid, uint8_t code)
 	exec->stdoutfd = -1;
 	close(exec->stderrfd);
 	exec->stderrfd = -1;
+	close(exec->pidfd);
+	exec->pidfd = -1;
 
 	hyper_release_exec(exec, pod);
 
@@ -871,6 +1868,11 @@ void hyper_cleanup_exec(struct hyper_pod *pod)
 
 	list_for_each_entry_safe(exec, next, &pod->exec_head, list) {
 		fprintf(stdout, "send eof for exec seq %" PRIu64 "\n", exec->seq);
+		if (exec->capture) {
+			if (hyper_send_exec_result(exec) < 0)
+				fprintf(stderr, "send exec result failed\n");
+			continue;
+		}
 		if (hyper_send_exec_eof(exec, 1) < 0 ||
 		    hyper_send_exec_code(exec, 1) < 0)
 			fprintf(stderr, "send eof failed\n");
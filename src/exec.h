@@ -4,6 +4,20 @@
 #include "list.h"
 #include "event.h"
 
+/* bound of each captured stream, keeps EXECRESULT within a uint32 length */
+#define HYPER_EXEC_CAPTURE_MAX	(1024 * 1024)
+
+/*
+ * Flow control frames travel on seq 0 of the tty channel, the payload is
+ * type (u8), stream seq (be64) and value (be32).
+ */
+#define TTY_CTRL_SEQ		0
+#define TTY_CTRL_LEN		(12 + 13)
+/* guest to host: the host may send value more stdin bytes to seq */
+#define TTY_CTRL_STDIN_CREDIT	1
+/* host to guest: the guest may send value more output bytes of seq */
+#define TTY_CTRL_OUTPUT_WINDOW	2
+
 struct env {
 	char	*env;
 	char	*value;
@@ -21,6 +35,7 @@ struct hyper_exec {
 	int			stdinfd;
 	int			stdoutfd;
 	int			stderrfd;
+	int			pidfd;
 	uint8_t			close_stdin_request;
 	uint8_t			code;
 	uint8_t			exit;
@@ -40,12 +55,37 @@ struct hyper_exec {
 	uint64_t		seq;
 	uint64_t		errseq;
 	char			*workdir;
+	/*
+	 * max bytes of stdout and stderr kept for EXECRESULT, 0 streams them,
+	 * at most HYPER_EXEC_CAPTURE_MAX
+	 */
+	uint32_t		capture;
+	struct hyper_buf	capout;
+	struct hyper_buf	caperr;
+	uint8_t			truncated;
+	/* stdin credits are granted to the host, see TTY_CTRL_STDIN_CREDIT */
+	uint8_t			flow_control;
+	/* credit not sent yet, coalesced until the tty buffer has room */
+	uint32_t		stdin_credit;
+	/* output bytes the host still accepts for seq and errseq */
+	uint32_t		out_window;
+	uint32_t		err_window;
 };
 
 struct hyper_pod;
+struct hyper_exec_env;
+struct hyper_exec_path;
 
 int hyper_exec_cmd(char *json, int length);
+int hyper_cmd_exec_batch(char *json, int length, uint32_t *datalen, uint8_t **data);
 int hyper_run_process(struct hyper_exec *e);
+int hyper_signal_exec(struct hyper_exec *exec, int sig);
+int hyper_exec_queue_stdin(struct hyper_exec *exec, uint8_t *data, uint32_t len);
+int hyper_handle_tty_ctrl(struct hyper_pod *pod, uint8_t *data, uint32_t len);
+void hyper_flush_tty_credits(struct hyper_pod *pod, struct hyper_event *tty);
+void hyper_free_exec_env(struct hyper_exec_env *env);
+void hyper_free_exec_paths(struct hyper_exec_path *ep);
+int hyper_cmd_flush_exec_cache(char *json, int length);
 struct hyper_exec *hyper_find_exec_by_pid(struct list_head *head, int pid);
 struct hyper_exec *hyper_find_exec_by_seq(struct hyper_pod *pod, uint64_t seq);
 int hyper_handle_exec_exit(struct hyper_pod *pod, int pid, uint8_t code);
@@ -40,6 +40,12 @@ enum {
 	SETUPINTERFACE,
 	SETUPROUTE,
 	REMOVECONTAINER,
+	MEMORYSTATS,
+	RECLAIMMEMORY,
+	MEMORYREPORT,
+	FLUSHEXECCACHE,
+	EXECBATCH,
+	EXECRESULT,
 };
 
 enum {
@@ -48,6 +54,15 @@ enum {
 	POLICY_ONFAILURE,
 };
 
+struct hyper_share_options {
+	/* "9p" (default) or "virtiofs" */
+	char			*fstype;
+	char			*cache;
+	char			*version;
+	uint32_t		msize;
+	uint8_t			dax;
+};
+
 struct hyper_pod {
 	struct hyper_interface	*iface;
 	struct hyper_route	*rt;
@@ -57,7 +72,12 @@ struct hyper_pod {
 	struct list_head	exec_head;
 	char			*hostname;
 	char			*share_tag;
+	struct hyper_share_options	share_opt;
 	int			init_pid;
+	/* pid, uts and ipc ns of pod init, opened once it runs */
+	int			pidns;
+	int			utsns;
+	int			ipcns;
 	uint32_t		i_num;
 	uint32_t		r_num;
 	uint32_t		d_num;
@@ -66,6 +86,8 @@ struct hyper_pod {
 	uint32_t		remains;
 	uint8_t			policy;
 	int			efd;
+	/* seconds between clock drift corrections, 0 disables */
+	uint32_t		time_sync;
 };
 
 struct portmapping_white_list {
@@ -93,10 +115,17 @@ struct hyper_writter {
 	int		len;
 };
 
+/* sh.hyper.channel.1 and up carry exec stdio, an exec sticks to one */
+#define HYPER_TTY_CHANNELS_MAX	8
+
 struct hyper_ctl {
 	int			efd;
-	struct hyper_event	tty;
+	struct hyper_event	tty[HYPER_TTY_CHANNELS_MAX];
+	int			ntty;
 	struct hyper_event	chan;
+	struct hyper_event	uevent;
+	struct hyper_event	memory;
+	struct hyper_event	clock;
 };
 
 static inline int hyper_symlink(char *oldpath, char *newpath)
@@ -28,10 +28,17 @@
 #include "parse.h"
 #include "container.h"
 #include "syscall.h"
+#include "uevent.h"
+#include "mem.h"
+#include "clock.h"
+#include "transport.h"
 
 struct hyper_pod global_pod = {
 	.containers	=	LIST_HEAD_INIT(global_pod.containers),
 	.exec_head	=	LIST_HEAD_INIT(global_pod.exec_head),
+	.pidns		=	-1,
+	.utsns		=	-1,
+	.ipcns		=	-1,
 };
 
 #define MAXEVENTS	10
@@ -209,11 +216,16 @@ static int hyper_pod_init(void *data)
 	struct hyper_pod_arg *arg = data;
 	struct hyper_pod *pod = arg->pod;
 	sigset_t mask;
+	int i;
 
 	close(arg->ctl_pipe[0]);
 	close(ctl.efd);
 	close(ctl.chan.fd);
-	close(ctl.tty.fd);
+	for (i = 0; i < ctl.ntty; i++)
+		close(ctl.tty[i].fd);
+	close(ctl.uevent.fd);
+	close(ctl.memory.fd);
+	close(ctl.clock.fd);
 
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGCHLD);
@@ -262,6 +274,11 @@ static int hyper_start_containers(struct hyper_pod *pod)
 {
 	struct hyper_container *c;
 
+	if (hyper_scan_container_disks(pod, NULL) < 0) {
+		fprintf(stderr, "discover container disks failed\n");
+		return -1;
+	}
+
 	// TODO: setup containers and run container init processes
 	//       via separated hyperstart APIs
 	list_for_each_entry(c, &pod->containers, list) {
@@ -275,6 +292,41 @@ static int hyper_start_containers(struct hyper_pod *pod)
 	return 0;
 }
 
+static int hyper_open_pod_ns(struct hyper_pod *pod, const char *ns)
+{
+	char path[512];
+	int fd;
+
+	sprintf(path, "/proc/%d/ns/%s", pod->init_pid, ns);
+	fd = open(path, O_RDONLY| O_CLOEXEC);
+	if (fd < 0)
+		fprintf(stderr, "fail to open %sns of pod init: %s\n", ns, strerror(errno));
+
+	return fd;
+}
+
+static int hyper_open_pod_namespaces(struct hyper_pod *pod)
+{
+	pod->pidns = hyper_open_pod_ns(pod, "pid");
+	pod->utsns = hyper_open_pod_ns(pod, "uts");
+	pod->ipcns = hyper_open_pod_ns(pod, "ipc");
+
+	if (pod->pidns < 0 || pod->utsns < 0 || pod->ipcns < 0)
+		return -1;
+
+	return 0;
+}
+
+static void hyper_close_pod_namespaces(struct hyper_pod *pod)
+{
+	close(pod->pidns);
+	pod->pidns = -1;
+	close(pod->utsns);
+	pod->utsns = -1;
+	close(pod->ipcns);
+	pod->ipcns = -1;
+}
+
 static int hyper_setup_pod_init(struct hyper_pod *pod)
 {
 	int stacksize = getpagesize() * 4;
@@ -322,6 +374,9 @@ static int hyper_setup_pod_init(struct hyper_pod *pod)
 		goto out;
 	}
 
+	if (hyper_open_pod_namespaces(pod) < 0)
+		goto out;
+
 	ret = 0;
 out:
 	close(arg.ctl_pipe[1]);
@@ -335,33 +390,11 @@ out:
 // enter the sanbox and pass to the child, shouldn't call from the init process
 int hyper_enter_sandbox(struct hyper_pod *pod, int pidpipe)
 {
-	int ret = -1, pidns = -1, utsns = -1, ipcns = -1;
-	char path[512];
-
-	sprintf(path, "/proc/%d/ns/pid", pod->init_pid);
-	pidns = open(path, O_RDONLY| O_CLOEXEC);
-	if (pidns < 0) {
-		perror("fail to open pidns of pod init");
-		goto out;
-	}
-
-	sprintf(path, "/proc/%d/ns/uts", pod->init_pid);
-	utsns = open(path, O_RDONLY| O_CLOEXEC);
-	if (utsns < 0) {
-		perror("fail to open utsns of pod init");
-		goto out;
-	}
-
-	sprintf(path, "/proc/%d/ns/ipc", pod->init_pid);
-	ipcns = open(path, O_RDONLY| O_CLOEXEC);
-	if (ipcns < 0) {
-		perror("fail to open ipcns of pod init");
-		goto out;
-	}
+	int ret = -1;
 
-	if (setns(pidns, CLONE_NEWPID) < 0 ||
-	    setns(utsns, CLONE_NEWUTS) < 0 ||
-	    setns(ipcns, CLONE_NEWIPC) < 0) {
+	if (setns(pod->pidns, CLONE_NEWPID) < 0 ||
+	    setns(pod->utsns, CLONE_NEWUTS) < 0 ||
+	    setns(pod->ipcns, CLONE_NEWIPC) < 0) {
 		perror("fail to enter the sandbox");
 		goto out;
 	}
@@ -382,10 +415,6 @@ int hyper_enter_sandbox(struct hyper_pod *pod, int pidpipe)
 	}
 
 out:
-	close(pidns);
-	close(ipcns);
-	close(utsns);
-
 	return ret;
 }
 
@@ -449,20 +478,47 @@ static int hyper_setup_shared(struct hyper_pod *pod)
 	return 0;
 }
 #else
-static int hyper_setup_shared(struct hyper_pod *pod)
+/* default 4k-8k msize makes every read and write a round trip per page */
+#define HYPER_9P_MSIZE	262144
+
+static int hyper_mount_virtiofs(struct hyper_pod *pod)
 {
-	if (pod->share_tag == NULL) {
-		fprintf(stdout, "no shared directroy\n");
+	char *opts = pod->share_opt.dax ? "dax=always" : NULL;
+
+	if (mount(pod->share_tag, "/tmp/hyper/shared", "virtiofs",
+		  MS_NODEV, opts) == 0)
 		return 0;
-	}
 
-	if (hyper_mkdir("/tmp/hyper/shared", 0755) < 0) {
-		perror("fail to create /tmp/hyper/shared");
+	/* kernels before 5.17 only know the plain "dax" option */
+	if (errno == EINVAL && opts != NULL &&
+	    mount(pod->share_tag, "/tmp/hyper/shared", "virtiofs",
+		  MS_NODEV, "dax") == 0)
+		return 0;
+
+	perror("fail to mount virtiofs shared dir");
+	return -1;
+}
+
+static int hyper_mount_9p(struct hyper_pod *pod)
+{
+	struct hyper_share_options *opt = &pod->share_opt;
+	char opts[256];
+	int len;
+
+	len = snprintf(opts, sizeof(opts), "trans=virtio,msize=%" PRIu32,
+		       opt->msize ? opt->msize : HYPER_9P_MSIZE);
+	if (opt->version)
+		len += snprintf(opts + len, sizeof(opts) - len, ",version=%s", opt->version);
+	if (opt->cache)
+		len += snprintf(opts + len, sizeof(opts) - len, ",cache=%s", opt->cache);
+	if (len >= sizeof(opts)) {
+		fprintf(stderr, "9p mount options too long\n");
 		return -1;
 	}
 
+	fprintf(stdout, "mount 9p shared dir with %s\n", opts);
 	if (mount(pod->share_tag, "/tmp/hyper/shared", "9p",
-		  MS_MGC_VAL| MS_NODEV, "trans=virtio") < 0) {
+		  MS_MGC_VAL| MS_NODEV, opts) < 0) {
 
 		perror("fail to mount shared dir");
 		return -1;
@@ -470,6 +526,24 @@ static int hyper_setup_shared(struct hyper_pod *pod)
 
 	return 0;
 }
+
+static int hyper_setup_shared(struct hyper_pod *pod)
+{
+	if (pod->share_tag == NULL) {
+		fprintf(stdout, "no shared directroy\n");
+		return 0;
+	}
+
+	if (hyper_mkdir("/tmp/hyper/shared", 0755) < 0) {
+		perror("fail to create /tmp/hyper/shared");
+		return -1;
+	}
+
+	if (pod->share_opt.fstype && !strcmp(pod->share_opt.fstype, "virtiofs"))
+		return hyper_mount_virtiofs(pod);
+
+	return hyper_mount_9p(pod);
+}
 #endif
 
 static int hyper_setup_pod(struct hyper_pod *pod)
@@ -505,6 +579,10 @@ static int hyper_setup_pod(struct hyper_pod *pod)
 		return -1;
 	}
 
+	/* containers fall back to mounting their own */
+	if (hyper_setup_mount_template(pod) < 0)
+		fprintf(stderr, "setup mount template failed\n");
+
 	return 0;
 }
 
@@ -543,12 +621,20 @@ static int hyper_start_pod(char *json, int length)
 	if (pod->init_pid)
 		fprintf(stdout, "pod init_pid exist %d\n", pod->init_pid);
 
-	hyper_sync_time_hctosys();
+	/* containers must not start with a wrong clock */
+	if (hyper_sync_time() < 0)
+		fprintf(stderr, "sync time failed\n");
+
 	if (hyper_parse_pod(pod, json, length) < 0) {
 		fprintf(stderr, "parse pod json failed\n");
 		return -1;
 	}
 
+	if (hyper_setup_time_sync(pod) < 0) {
+		hyper_destroy_pod(pod, 1);
+		return -1;
+	}
+
 	if (hyper_setup_pod(pod) < 0) {
 		hyper_destroy_pod(pod, 1);
 		return -1;
@@ -583,7 +669,9 @@ static int hyper_new_container(char *json, int length)
 	}
 
 	list_add_tail(&c->list, &pod->containers);
-	ret = hyper_setup_container(c, pod);
+	ret = hyper_scan_container_disks(pod, c);
+	if (ret >= 0)
+		ret = hyper_setup_container(c, pod);
 	if (ret >= 0)
 		ret = hyper_run_process(&c->exec);
 	if (ret < 0) {
@@ -613,7 +701,7 @@ static int hyper_kill_container(char *json, int length)
 		goto out;
 	}
 
-	kill(c->exec.pid, (int)json_object_get_number(json_object(value), "signal"));
+	hyper_signal_exec(&c->exec, (int)json_object_get_number(json_object(value), "signal"));
 	ret = 0;
 out:
 	json_value_free(value);
@@ -876,18 +964,6 @@ out:
 	return ret;
 }
 
-static void hyper_cmd_online_cpu_mem()
-{
-	int pid = fork();
-	if (pid < 0) {
-		perror("fail to fork online process");
-	} else if (pid == 0) {
-		online_cpu();
-		online_memory();
-		exit(0);
-	}
-}
-
 static void hyper_cleanup_hostname(struct hyper_pod *pod)
 {
 	free(pod->hostname);
@@ -896,6 +972,11 @@ static void hyper_cleanup_hostname(struct hyper_pod *pod)
 
 static void hyper_cleanup_shared(struct hyper_pod *pod)
 {
+	free(pod->share_opt.fstype);
+	free(pod->share_opt.cache);
+	free(pod->share_opt.version);
+	memset(&pod->share_opt, 0, sizeof(pod->share_opt));
+
 	if (pod->share_tag == NULL) {
 		fprintf(stdout, "no shared directroy\n");
 		return;
@@ -921,12 +1002,15 @@ void hyper_cleanup_pod(struct hyper_pod *pod)
 		hyper_kill_process(pod->init_pid);
 		pod->init_pid = 0;
 	}
+	hyper_close_pod_namespaces(pod);
 	hyper_cleanup_containers(pod);
+	hyper_cleanup_mount_template();
 	hyper_cleanup_network(pod);
 	hyper_cleanup_shared(pod);
 	hyper_cleanup_dns(pod);
 	hyper_cleanup_portmapping(pod);
 	hyper_cleanup_hostname(pod);
+	hyper_cleanup_time_sync(pod);
 }
 
 static int hyper_stop_pod(struct hyper_pod *pod)
@@ -943,6 +1027,17 @@ static int hyper_stop_pod(struct hyper_pod *pod)
 	return 0;
 }
 
+static int hyper_ctl_channel_ready(int fd)
+{
+	fprintf(stdout, "send ready message\n");
+	if (hyper_send_type(fd, READY) < 0) {
+		perror("send READY MESSAGE failed\n");
+		return -1;
+	}
+
+	return 0;
+}
+
 static int hyper_setup_ctl_channel(char *name)
 {
 	int ret = hyper_open_channel(name, 0);
@@ -950,11 +1045,8 @@ static int hyper_setup_ctl_channel(char *name)
 	if (ret < 0)
 		return ret;
 
-	fprintf(stdout, "send ready message\n");
-	if (hyper_send_type(ret, READY) < 0) {
-		perror("send READY MESSAGE failed\n");
+	if (hyper_ctl_channel_ready(ret) < 0)
 		goto out;
-	}
 
 	return ret;
 out:
@@ -971,6 +1063,107 @@ static int hyper_setup_tty_channel(char *name)
 	return ret;
 }
 
+/*
+ * The first tty channel is mandatory. The host may add more ports named
+ * sh.hyper.channel.2 and up; they are cold plugged with the first one, so
+ * probe them without waiting and stop at the first missing one.
+ */
+static int hyper_setup_tty_channels(char *name)
+{
+	ctl.tty[0].fd = hyper_setup_tty_channel(name);
+	if (ctl.tty[0].fd < 0)
+		return -1;
+	ctl.ntty = 1;
+
+#ifndef WITH_VBOX
+	for (; ctl.ntty < HYPER_TTY_CHANNELS_MAX; ctl.ntty++) {
+		char channel[32];
+		int fd;
+		struct hyper_device dev = {
+			.type	= HYPER_DEV_VIRTIO_PORT,
+			.id	= channel,
+		};
+
+		sprintf(channel, "sh.hyper.channel.%d", ctl.ntty + 1);
+		if (!hyper_device_present(&dev))
+			break;
+
+		fd = hyper_setup_tty_channel(channel);
+		if (fd < 0)
+			break;
+		ctl.tty[ctl.ntty].fd = fd;
+	}
+#endif
+	fprintf(stdout, "%d tty channels\n", ctl.ntty);
+	return 0;
+}
+
+static void hyper_close_tty_channels(void)
+{
+	int i;
+
+	for (i = 0; i < ctl.ntty; i++)
+		close(ctl.tty[i].fd);
+	ctl.ntty = 0;
+}
+
+/*
+ * The host connects the control channel first, then t->ntty tty
+ * channels, one after another so they are accepted in that order.
+ */
+static int hyper_setup_socket_channels(struct hyper_transport *t)
+{
+	int lfd, fd;
+
+	ctl.chan.fd = -1;
+	lfd = hyper_transport_listen(t);
+	if (lfd < 0)
+		return -1;
+
+	ctl.chan.fd = hyper_transport_accept(lfd, 0);
+	if (ctl.chan.fd < 0)
+		goto fail;
+
+	if (hyper_ctl_channel_ready(ctl.chan.fd) < 0)
+		goto fail;
+
+	while (ctl.ntty < t->ntty) {
+		fd = hyper_transport_accept(lfd, 1);
+		if (fd < 0)
+			goto fail;
+		ctl.tty[ctl.ntty++].fd = fd;
+	}
+
+	fprintf(stdout, "%d tty channels\n", ctl.ntty);
+	close(lfd);
+	return 0;
+fail:
+	hyper_close_tty_channels();
+	if (ctl.chan.fd >= 0)
+		close(ctl.chan.fd);
+	ctl.chan.fd = -1;
+	close(lfd);
+	return -1;
+}
+
+static int hyper_setup_serial_channels(char *ctl_serial, char *tty_serial)
+{
+	ctl.chan.fd = hyper_setup_ctl_channel(ctl_serial);
+	if (ctl.chan.fd < 0) {
+		fprintf(stderr, "fail to setup hyper control serial port\n");
+		return -1;
+	}
+
+	if (hyper_setup_tty_channels(tty_serial) < 0) {
+		fprintf(stderr, "fail to setup hyper tty serial port\n");
+		close(ctl.chan.fd);
+		ctl.chan.fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
 static int hyper_ttyfd_handle(struct hyper_event *de, uint32_t len)
 {
 	struct hyper_buf *rbuf = &de->rbuf;
@@ -978,12 +1171,14 @@ static int hyper_ttyfd_handle(struct hyper_event *de, uint32_t len)
 	struct hyper_exec *exec;
 	struct hyper_buf *wbuf;
 	uint64_t seq = 0;
-	int size;
 
 	seq = hyper_get_be64(rbuf->data);
 
 	dprintf(stdout, "\n%s seq %" PRIu64", len %" PRIu32"\n", __func__, seq, len - 12);
 
+	if (seq == TTY_CTRL_SEQ)
+		return hyper_handle_tty_ctrl(pod, rbuf->data + 12, len - 12);
+
 	exec = hyper_find_exec_by_seq(pod, seq);
 	if (exec == NULL) {
 		wbuf = &de->wbuf;
@@ -1013,37 +1208,7 @@ static int hyper_ttyfd_handle(struct hyper_event *de, uint32_t len)
 		return 0;
 	}
 
-	wbuf = &exec->stdinev.wbuf;
-
-	size = wbuf->size - wbuf->get;
-	if (size == 0)
-		return 0;
-
-	/* Data may lost since pts buffer is full. do not allow one exec pts occupy all
-	 * of the tty buff. */
-	if (size > (len - 12))
-		size = (len - 12);
-
-	/* size == 0 means we had received eof */
-	if (size == 0 && !exec->tty) {
-		exec->close_stdin_request = 1;
-		/* we can't hup the stdinev here, force hup on next write */
-		if (hyper_modify_event(ctl.efd, &exec->stdinev, EPOLLOUT) < 0) {
-			fprintf(stderr, "modify exec pts event to in & out failed\n");
-			return -1;
-		}
-	}
-
-	if (size > 0) {
-		memcpy(wbuf->data + wbuf->get, rbuf->data + 12, size);
-		wbuf->get += size;
-		if (hyper_modify_event(ctl.efd, &exec->stdinev, EPOLLOUT) < 0) {
-			fprintf(stderr, "modify exec pts event to in & out failed\n");
-			return -1;
-		}
-	}
-
-	return 0;
+	return hyper_exec_queue_stdin(exec, rbuf->data + 12, len - 12);
 }
 
 static int hyper_channel_handle(struct hyper_event *de, uint32_t len)
@@ -1084,6 +1249,9 @@ static int hyper_channel_handle(struct hyper_event *de, uint32_t len)
 	case EXECCMD:
 		ret = hyper_exec_cmd((char *)buf->data + 8, len - 8);
 		break;
+	case EXECBATCH:
+		ret = hyper_cmd_exec_batch((char *)buf->data + 8, len - 8, &datalen, &data);
+		break;
 	case WRITEFILE:
 		ret = hyper_cmd_write_file((char *)buf->data + 8, len - 8);
 		break;
@@ -1109,7 +1277,7 @@ static int hyper_channel_handle(struct hyper_event *de, uint32_t len)
 		ret = hyper_remove_container((char *)buf->data + 8, len - 8);
 		break;
 	case ONLINECPUMEM:
-		hyper_cmd_online_cpu_mem();
+		ret = hyper_cmd_online_cpu_mem((char *)buf->data + 8, len - 8);
 		break;
 	case SETUPINTERFACE:
 		ret = hyper_cmd_setup_interface((char *)buf->data + 8, len - 8);
@@ -1117,6 +1285,15 @@ static int hyper_channel_handle(struct hyper_event *de, uint32_t len)
 	case SETUPROUTE:
 		ret = hyper_cmd_setup_route((char *)buf->data + 8, len - 8);
 		break;
+	case MEMORYSTATS:
+		ret = hyper_cmd_memory_stats((char *)buf->data + 8, len - 8, &datalen, &data);
+		break;
+	case RECLAIMMEMORY:
+		ret = hyper_cmd_reclaim_memory((char *)buf->data + 8, len - 8, &datalen, &data);
+		break;
+	case FLUSHEXECCACHE:
+		ret = hyper_cmd_flush_exec_cache((char *)buf->data + 8, len - 8);
+		break;
 	default:
 		ret = -1;
 		break;
@@ -1140,9 +1317,19 @@ static struct hyper_event_ops hyper_channel_ops = {
 	.ack		= 1,
 };
 
+/* stdin credits held back while the buffer was full go out first */
+static int hyper_ttyfd_write(struct hyper_event *de, int efd)
+{
+	if (hyper_event_write(de, efd) < 0)
+		return -1;
+
+	hyper_flush_tty_credits(de->ptr, de);
+	return 0;
+}
+
 static struct hyper_event_ops hyper_ttyfd_ops = {
 	.read		= hyper_event_read,
-	.write		= hyper_event_write,
+	.write		= hyper_ttyfd_write,
 	.handle		= hyper_ttyfd_handle,
 	.rbuf_size	= 4096,
 	.wbuf_size	= 10240,
@@ -1213,10 +1400,38 @@ static int hyper_loop(void)
 		return -1;
 	}
 
-	fprintf(stdout, "hyper_init_event hyper ttyfd event %p, ops %p, fd %d\n",
-		&ctl.tty, &hyper_ttyfd_ops, ctl.tty.fd);
-	if (hyper_init_event(&ctl.tty, &hyper_ttyfd_ops, pod) < 0 ||
-	    hyper_add_event(ctl.efd, &ctl.tty, EPOLLIN) < 0) {
+	for (i = 0; i < ctl.ntty; i++) {
+		fprintf(stdout, "hyper_init_event hyper ttyfd event %p, ops %p, fd %d\n",
+			&ctl.tty[i], &hyper_ttyfd_ops, ctl.tty[i].fd);
+		if (hyper_init_event(&ctl.tty[i], &hyper_ttyfd_ops, pod) < 0 ||
+		    hyper_add_event(ctl.efd, &ctl.tty[i], EPOLLIN) < 0) {
+			return -1;
+		}
+	}
+
+	/* online hot-plugged cpus and memory as soon as the kernel reports them */
+	ctl.uevent.fd = hyper_uevent_open();
+	if (ctl.uevent.fd < 0 ||
+	    hyper_init_event(&ctl.uevent, &hyper_uevent_ops, pod) < 0 ||
+	    hyper_add_event(ctl.efd, &ctl.uevent, EPOLLIN) < 0) {
+		fprintf(stderr, "setup uevent listener failed\n");
+		return -1;
+	}
+
+	/* disarmed until the host asks for periodic memory reports */
+	ctl.memory.fd = hyper_memory_timer_open();
+	if (ctl.memory.fd < 0 ||
+	    hyper_init_event(&ctl.memory, &hyper_memory_ops, pod) < 0 ||
+	    hyper_add_event(ctl.efd, &ctl.memory, EPOLLIN) < 0) {
+		fprintf(stderr, "setup memory report timer failed\n");
+		return -1;
+	}
+
+	ctl.clock.fd = hyper_clock_timer_open();
+	if (ctl.clock.fd < 0 ||
+	    hyper_init_event(&ctl.clock, &hyper_clock_ops, pod) < 0 ||
+	    hyper_add_event(ctl.efd, &ctl.clock, EPOLLIN) < 0) {
+		fprintf(stderr, "setup time sync timer failed\n");
 		return -1;
 	}
 
@@ -1246,6 +1461,8 @@ static int hyper_loop(void)
 int main(int argc, char *argv[])
 {
 	char *cmdline, *ctl_serial, *tty_serial;
+	struct hyper_transport transport;
+	int ret;
 
 	if (hyper_mkdir("/dev", 0755) < 0 ||
 	    hyper_mkdir("/sys", 0755) < 0 ||
@@ -1312,24 +1529,22 @@ int main(int argc, char *argv[])
 
 	setenv("PATH", "/bin:/sbin/:/usr/bin/:/usr/sbin/", 1);
 
-	ctl.chan.fd = hyper_setup_ctl_channel(ctl_serial);
-	if (ctl.chan.fd < 0) {
-		fprintf(stderr, "fail to setup hyper control serial port\n");
-		goto out1;
-	}
+	if (hyper_parse_transport(&transport, cmdline) < 0)
+		goto out;
 
-	ctl.tty.fd = hyper_setup_tty_channel(tty_serial);
-	if (ctl.tty.fd < 0) {
-		fprintf(stderr, "fail to setup hyper tty serial port\n");
-		goto out2;
-	}
+	if (transport.type == HYPER_TRANSPORT_SERIAL)
+		ret = hyper_setup_serial_channels(ctl_serial, tty_serial);
+	else
+		ret = hyper_setup_socket_channels(&transport);
+	if (ret < 0)
+		goto out;
 
 	hyper_loop();
 
-	close(ctl.tty.fd);
-out2:
+	hyper_close_tty_channels();
 	close(ctl.chan.fd);
-out1:
+out:
+	hyper_free_transport(&transport);
 	free(cmdline);
 
 	return 0;
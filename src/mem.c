@@ -0,0 +1,388 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "hyper.h"
+#include "util.h"
+#include "parse.h"
+#include "mem.h"
+
+/* reclaim clean page cache and compact memory before each periodic report */
+static int hyper_memory_auto_reclaim;
+/* read end of a pipe held by the reclaim helper, hup once it exits */
+static int hyper_memory_reclaim_fd = -1;
+
+enum {
+	MEM_TOTAL,
+	MEM_FREE,
+	MEM_AVAILABLE,
+	MEM_BUFFERS,
+	MEM_CACHED,
+	MEM_DIRTY,
+	MEM_SHMEM,
+	MEM_SRECLAIMABLE,
+	MEM_NR,
+};
+
+static const struct hyper_meminfo {
+	const char	*key;
+	const char	*name;
+} hyper_meminfo[MEM_NR] = {
+	[MEM_TOTAL]		= { "MemTotal:",	"total" },
+	[MEM_FREE]		= { "MemFree:",		"free" },
+	[MEM_AVAILABLE]		= { "MemAvailable:",	"available" },
+	[MEM_BUFFERS]		= { "Buffers:",		"buffers" },
+	[MEM_CACHED]		= { "Cached:",		"cached" },
+	[MEM_DIRTY]		= { "Dirty:",		"dirty" },
+	[MEM_SHMEM]		= { "Shmem:",		"shmem" },
+	[MEM_SRECLAIMABLE]	= { "SReclaimable:",	"slabReclaimable" },
+};
+
+static int hyper_read_meminfo(uint64_t kb[MEM_NR])
+{
+	char line[256], key[64];
+	uint64_t value;
+	FILE *fp;
+	int i;
+
+	fp = fopen("/proc/meminfo", "r");
+	if (fp == NULL) {
+		perror("open /proc/meminfo failed");
+		return -1;
+	}
+
+	memset(kb, 0, sizeof(uint64_t) * MEM_NR);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%63s %" SCNu64, key, &value) != 2)
+			continue;
+
+		for (i = 0; i < MEM_NR; i++) {
+			if (strcmp(key, hyper_meminfo[i].key) == 0)
+				kb[i] = value;
+		}
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+/* clean page cache, which drop_caches can give back */
+static int64_t hyper_clean_cache_kb(uint64_t kb[MEM_NR])
+{
+	return (int64_t)kb[MEM_BUFFERS] + kb[MEM_CACHED] - kb[MEM_DIRTY] - kb[MEM_SHMEM];
+}
+
+/*
+ * Collect /proc/meminfo and /proc/pressure/memory into a json object, all
+ * sizes are in kB. "reclaimable" estimates what can be given back to the
+ * host: free memory plus clean, unmapped page cache and reclaimable slab.
+ */
+static JSON_Value *hyper_memory_stats(void)
+{
+	char line[256], kind[8];
+	double avg10, avg60, avg300;
+	uint64_t kb[MEM_NR];
+	int64_t reclaimable;
+	JSON_Value *value;
+	JSON_Object *obj;
+	FILE *fp;
+	int i;
+
+	if (hyper_read_meminfo(kb) < 0)
+		return NULL;
+
+	value = json_value_init_object();
+	if (value == NULL)
+		return NULL;
+	obj = json_object(value);
+
+	for (i = 0; i < MEM_NR; i++)
+		json_object_set_number(obj, hyper_meminfo[i].name, kb[i]);
+
+	reclaimable = kb[MEM_FREE] + hyper_clean_cache_kb(kb) + kb[MEM_SRECLAIMABLE];
+	json_object_set_number(obj, "reclaimable", reclaimable > 0 ? reclaimable : 0);
+
+	/* no CONFIG_PSI, report meminfo only */
+	fp = fopen("/proc/pressure/memory", "r");
+	if (fp == NULL)
+		return value;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%7s avg10=%lf avg60=%lf avg300=%lf",
+			   kind, &avg10, &avg60, &avg300) != 4)
+			continue;
+
+		if (strcmp(kind, "some") == 0) {
+			json_object_set_number(obj, "pressureSome10", avg10);
+			json_object_set_number(obj, "pressureSome60", avg60);
+		} else if (strcmp(kind, "full") == 0) {
+			json_object_set_number(obj, "pressureFull10", avg10);
+			json_object_set_number(obj, "pressureFull60", avg60);
+		}
+	}
+	fclose(fp);
+
+	return value;
+}
+
+static int hyper_memory_stats_msg(uint32_t *datalen, uint8_t **data)
+{
+	JSON_Value *value;
+	char *str;
+
+	value = hyper_memory_stats();
+	if (value == NULL) {
+		fprintf(stderr, "collect memory stats failed\n");
+		return -1;
+	}
+
+	str = json_serialize_to_string(value);
+	json_value_free(value);
+	if (str == NULL) {
+		fprintf(stderr, "serialize memory stats failed\n");
+		return -1;
+	}
+
+	*data = (uint8_t *)str;
+	*datalen = strlen(str);
+	return 0;
+}
+
+/*
+ * mode: 1 page cache, 2 dentries and inodes, 3 both. Only clean pages are
+ * dropped, dirty ones are left to the writeback of the kernel instead of a
+ * global sync() which could block init for long.
+ */
+static int hyper_reclaim_memory(int drop_caches, int compact)
+{
+	char mode[2];
+	int ret = 0;
+
+	if (drop_caches > 0) {
+		if (drop_caches > 3) {
+			fprintf(stderr, "invalid drop caches mode %d\n", drop_caches);
+			return -1;
+		}
+
+		mode[0] = '0' + drop_caches;
+		mode[1] = '\0';
+		if (hyper_write_file("/proc/sys/vm/drop_caches", mode, 1) < 0) {
+			fprintf(stderr, "drop caches failed\n");
+			ret = -1;
+		}
+	}
+
+	/* hand contiguous free ranges to the balloon / free page reporting */
+	if (compact && hyper_write_file("/proc/sys/vm/compact_memory", "1", 1) < 0) {
+		fprintf(stderr, "compact memory failed\n");
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/*
+ * MEMORYSTATS replies with the current stats. A payload of
+ * {"interval": seconds, "reclaim": bool} also (re)arms the periodic
+ * MEMORYREPORT message, interval 0 stops it.
+ */
+int hyper_cmd_memory_stats(char *json, int length, uint32_t *datalen, uint8_t **data)
+{
+	struct itimerspec its;
+	JSON_Value *value;
+	JSON_Object *obj;
+	int interval;
+
+	if (length > 0) {
+		value = hyper_json_parse(json, length);
+		if (value == NULL) {
+			fprintf(stderr, "parse memory stats request failed\n");
+			return -1;
+		}
+		obj = json_object(value);
+
+		if (json_object_get_value(obj, "interval") != NULL) {
+			interval = (int)json_object_get_number(obj, "interval");
+			hyper_memory_auto_reclaim = json_object_get_boolean(obj, "reclaim") > 0;
+
+			memset(&its, 0, sizeof(its));
+			its.it_value.tv_sec = its.it_interval.tv_sec = interval > 0 ? interval : 0;
+			if (timerfd_settime(ctl.memory.fd, 0, &its, NULL) < 0) {
+				perror("set memory report timer failed");
+				json_value_free(value);
+				return -1;
+			}
+			fprintf(stdout, "memory report interval %d, reclaim %d\n",
+				interval, hyper_memory_auto_reclaim);
+		}
+		json_value_free(value);
+	}
+
+	return hyper_memory_stats_msg(datalen, data);
+}
+
+/*
+ * Reclaim runs in a nice 19 helper, compaction can take seconds on a big
+ * guest and init's event loop must keep going meanwhile. The helper is
+ * reaped by the SIGCHLD handler of init, a pipe tells if it is still
+ * running without racing with that handler.
+ */
+static int hyper_memory_reclaim_running(int timeout_ms)
+{
+	struct pollfd pfd = {
+		.fd	= hyper_memory_reclaim_fd,
+		.events	= POLLIN,
+	};
+
+	if (hyper_memory_reclaim_fd < 0)
+		return 0;
+
+	if (poll(&pfd, 1, timeout_ms) == 0)
+		return 1;
+
+	close(hyper_memory_reclaim_fd);
+	hyper_memory_reclaim_fd = -1;
+	return 0;
+}
+
+static int hyper_memory_start_reclaim(int drop_caches, int compact)
+{
+	int pid, pipefd[2];
+
+	if (pipe2(pipefd, O_CLOEXEC) < 0) {
+		perror("create memory reclaim pipe failed");
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork memory reclaim helper failed");
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return -1;
+	} else if (pid == 0) {
+		close(pipefd[0]);
+		setpriority(PRIO_PROCESS, 0, 19);
+		_exit(hyper_reclaim_memory(drop_caches, compact) < 0 ? 1 : 0);
+	}
+
+	close(pipefd[1]);
+	hyper_memory_reclaim_fd = pipefd[0];
+	return 0;
+}
+
+/* how long RECLAIMMEMORY waits for the helper before replying anyway */
+#define HYPER_RECLAIM_TIMEOUT_MS	2000
+
+/*
+ * RECLAIMMEMORY {"dropCaches": 1|2|3, "compact": bool}, replies with the
+ * stats after reclaim so the host knows how much it can take back. A
+ * reclaim still running after HYPER_RECLAIM_TIMEOUT_MS goes on in the
+ * background, the reply then has the stats of that moment.
+ */
+int hyper_cmd_reclaim_memory(char *json, int length, uint32_t *datalen, uint8_t **data)
+{
+	int drop_caches = 1, compact = 1;
+	JSON_Value *value;
+	JSON_Object *obj;
+
+	if (length > 0) {
+		value = hyper_json_parse(json, length);
+		if (value == NULL) {
+			fprintf(stderr, "parse reclaim memory request failed\n");
+			return -1;
+		}
+		obj = json_object(value);
+
+		if (json_object_get_value(obj, "dropCaches") != NULL)
+			drop_caches = (int)json_object_get_number(obj, "dropCaches");
+		if (json_object_get_value(obj, "compact") != NULL)
+			compact = json_object_get_boolean(obj, "compact") > 0;
+		json_value_free(value);
+	}
+
+	if (drop_caches > 3) {
+		fprintf(stderr, "invalid drop caches mode %d\n", drop_caches);
+		return -1;
+	}
+
+	/* a periodic reclaim in progress does the work for us */
+	if (!hyper_memory_reclaim_running(0) &&
+	    hyper_memory_start_reclaim(drop_caches, compact) < 0)
+		return -1;
+
+	if (hyper_memory_reclaim_running(HYPER_RECLAIM_TIMEOUT_MS))
+		fprintf(stdout, "memory reclaim still running, reply now\n");
+
+	return hyper_memory_stats_msg(datalen, data);
+}
+
+int hyper_memory_timer_open(void)
+{
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		perror("create memory report timer failed");
+
+	return fd;
+}
+
+/*
+ * Periodic reclaim only happens when clean page cache is at least
+ * 1/HYPER_RECLAIM_CACHE_RATIO of the memory.
+ */
+#define HYPER_RECLAIM_CACHE_RATIO	4
+
+static void hyper_memory_background_reclaim(void)
+{
+	uint64_t kb[MEM_NR];
+
+	if (hyper_memory_reclaim_running(0)) {
+		fprintf(stdout, "memory reclaim helper still running\n");
+		return;
+	}
+
+	if (hyper_read_meminfo(kb) < 0 ||
+	    hyper_clean_cache_kb(kb) * HYPER_RECLAIM_CACHE_RATIO < (int64_t)kb[MEM_TOTAL])
+		return;
+
+	hyper_memory_start_reclaim(1, 1);
+}
+
+static int hyper_memory_timer_read(struct hyper_event *he, int efd)
+{
+	uint8_t *data = NULL;
+	uint32_t datalen;
+	uint64_t expired;
+
+	if (read(he->fd, &expired, sizeof(expired)) < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		perror("read memory report timer failed");
+		return 0;
+	}
+
+	if (hyper_memory_auto_reclaim)
+		hyper_memory_background_reclaim();
+
+	if (hyper_memory_stats_msg(&datalen, &data) < 0)
+		return 0;
+
+	hyper_send_msg_block(ctl.chan.fd, MEMORYREPORT, datalen, data);
+	free(data);
+
+	return 0;
+}
+
+struct hyper_event_ops hyper_memory_ops = {
+	.read		= hyper_memory_timer_read,
+};
@@ -0,0 +1,13 @@
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stdint.h>
+
+#include "event.h"
+
+int hyper_memory_timer_open(void);
+int hyper_cmd_memory_stats(char *json, int length, uint32_t *datalen, uint8_t **data);
+int hyper_cmd_reclaim_memory(char *json, int length, uint32_t *datalen, uint8_t **data);
+
+extern struct hyper_event_ops hyper_memory_ops;
+#endif
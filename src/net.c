@@ -7,7 +7,12 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <termios.h>
+#include <sys/ioctl.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
 
 #include "hyper.h"
 #include "util.h"
@@ -176,35 +181,7 @@ static int addattr_l(struct nlmsghdr *n, int maxlen, int type, void *data, int a
 	return 0;
 }
 
-static int hyper_get_ifindex(char *nic)
-{
-	int fd, ifindex = -1;
-	char path[512], buf[4];
-
-	fprintf(stdout, "net device %s\n", nic);
-	sprintf(path, "/sys/class/net/%s/ifindex", nic);
-	fprintf(stdout, "net device sys path is %s\n", path);
-
-	fd = open(path, O_RDONLY);
-	if (fd < 0) {
-		perror("can not open file");
-		return -1;
-	}
-
-	memset(buf, 0, sizeof(buf));
-	if (read(fd, buf, sizeof(buf)) <= 0) {
-		perror("can read open file");
-		goto out;
-	}
-
-	ifindex = atoi(buf);
-	fprintf(stdout, "get ifindex %d\n", ifindex);
-out:
-	close(fd);
-	return ifindex;
-}
-
-static int netlink_open(struct rtnl_handle *rth)
+static int netlink_open(struct rtnl_handle *rth, unsigned groups)
 {
 	memset(rth, 0, sizeof(*rth));
 
@@ -215,7 +192,7 @@ static int netlink_open(struct rtnl_handle *rth)
 	}
 
 	rth->local.nl_family = AF_NETLINK;
-	rth->local.nl_groups = 0;
+	rth->local.nl_groups = groups;
 
 	if (bind(rth->fd, (struct sockaddr *)&rth->local, sizeof(rth->local)) < 0) {
 		perror("cannot bind netlink socket");
@@ -234,6 +211,11 @@ static void netlink_close(struct rtnl_handle *rth)
 	if (rth->fd > 0)
 		close(rth->fd);
 	rth->fd = -1;
+
+	free(rth->links);
+	rth->links = NULL;
+	rth->l_num = 0;
+	rth->l_dumped = 0;
 }
 
 static int rtnl_talk(struct rtnl_handle *rtnl,
@@ -260,6 +242,199 @@ static int rtnl_talk(struct rtnl_handle *rtnl,
 	return 0;
 }
 
+static int hyper_cache_link(struct rtnl_handle *rth, struct nlmsghdr *h)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(h);
+	struct hyper_link *links;
+	struct rtattr *rta;
+	char *name = NULL;
+	int i, len;
+
+	if (h->nlmsg_type != RTM_NEWLINK && h->nlmsg_type != RTM_DELLINK)
+		return 0;
+
+	len = h->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+	if (len < 0)
+		return -1;
+
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_IFNAME) {
+			name = RTA_DATA(rta);
+			break;
+		}
+	}
+
+	if (name == NULL)
+		return 0;
+
+	/* match by index, so that a renamed link replaces its stale entry */
+	for (i = 0; i < rth->l_num; i++) {
+		if (rth->links[i].ifindex == ifi->ifi_index)
+			break;
+	}
+
+	if (h->nlmsg_type == RTM_DELLINK) {
+		if (i < rth->l_num)
+			rth->links[i] = rth->links[--rth->l_num];
+		return 0;
+	}
+
+	if (i == rth->l_num) {
+		links = realloc(rth->links, (rth->l_num + 1) * sizeof(*links));
+		if (links == NULL) {
+			fprintf(stderr, "allocate memory for link cache failed\n");
+			return -1;
+		}
+		rth->links = links;
+		rth->l_num++;
+	}
+
+	rth->links[i].ifindex = ifi->ifi_index;
+	snprintf(rth->links[i].name, sizeof(rth->links[i].name), "%s", name);
+
+	return 0;
+}
+
+/*
+ * Receive one batch of netlink messages and cache the links in it.
+ * Return 1 when the dump with sequence number @seq has finished.
+ */
+static int rtnl_recv_links(struct rtnl_handle *rth, __u32 seq)
+{
+	char buf[16384];
+	struct sockaddr_nl nladdr;
+	struct iovec iov = { buf, sizeof(buf) };
+	struct msghdr msg = { (void *)&nladdr, sizeof(nladdr), &iov, 1, NULL, 0, 0 };
+	struct nlmsghdr *h;
+	int len, done = 0;
+
+	len = recvmsg(rth->fd, &msg, 0);
+	if (len < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 0;
+		/* link events were lost, the cache must be rebuilt */
+		if (errno == ENOBUFS) {
+			rth->l_dumped = 0;
+			return seq != 0;
+		}
+		perror("receive netlink message failed");
+		return -1;
+	}
+
+	for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+		if (seq != 0 && h->nlmsg_seq == seq) {
+			if (h->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				continue;
+			}
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				fprintf(stderr, "netlink link dump failed\n");
+				return -1;
+			}
+		}
+
+		/* acks of the earlier requests are ignored here */
+		if (hyper_cache_link(rth, h) < 0)
+			return -1;
+	}
+
+	return done;
+}
+
+static int rtnl_dump_links(struct rtnl_handle *rth)
+{
+	struct {
+		struct nlmsghdr n;
+		struct ifinfomsg i;
+	} req;
+	int ret;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.n.nlmsg_type = RTM_GETLINK;
+	req.i.ifi_family = AF_UNSPEC;
+
+	/* the dump is answered by the link messages, no ack needed */
+	if (rtnl_talk(rth, &req.n, 0, 0, &req.n) < 0) {
+		perror("send link dump request failed");
+		return -1;
+	}
+
+	rth->l_num = 0;
+	rth->l_dumped = 1;
+	rth->dump = req.n.nlmsg_seq;
+
+	while ((ret = rtnl_recv_links(rth, rth->dump)) == 0)
+		;
+
+	return ret < 0 ? -1 : 0;
+}
+
+static int hyper_find_link(struct rtnl_handle *rth, char *nic)
+{
+	int i;
+
+	for (i = 0; i < rth->l_num; i++) {
+		if (strcmp(rth->links[i].name, nic) == 0)
+			return rth->links[i].ifindex;
+	}
+
+	return -1;
+}
+
+/*
+ * Resolve @nic to its ifindex from the link cache. If the netlink socket
+ * subscribes to link events, wait at most @timeout ms for a hot-plugged
+ * nic to show up.
+ */
+static int hyper_wait_ifindex(struct rtnl_handle *rth, char *nic, int timeout)
+{
+	struct pollfd pfd = {
+		.fd	= rth->fd,
+		.events	= POLLIN,
+	};
+	struct timespec start, now;
+	int ifindex, left = timeout;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (;;) {
+		if (!rth->l_dumped && rtnl_dump_links(rth) < 0)
+			return -1;
+
+		ifindex = hyper_find_link(rth, nic);
+		if (ifindex > 0) {
+			fprintf(stdout, "net device %s ifindex %d\n", nic, ifindex);
+			return ifindex;
+		}
+
+		if (!(rth->local.nl_groups & RTMGRP_LINK) || left <= 0)
+			break;
+
+		fprintf(stdout, "wait for net device %s, %d ms left\n", nic, left);
+		if (poll(&pfd, 1, left) < 0 && errno != EINTR) {
+			perror("poll netlink socket failed");
+			return -1;
+		}
+
+		if ((pfd.revents & POLLIN) && rtnl_recv_links(rth, 0) < 0)
+			return -1;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left = timeout - ((now.tv_sec - start.tv_sec) * 1000 +
+				  (now.tv_nsec - start.tv_nsec) / 1000000);
+	}
+
+	fprintf(stderr, "can not find net device %s\n", nic);
+	return -1;
+}
+
+static int hyper_get_ifindex(struct rtnl_handle *rth, char *nic)
+{
+	return hyper_wait_ifindex(rth, nic, 0);
+}
+
 static int hyper_up_nic(struct rtnl_handle *rth, int ifindex)
 {
 	struct {
@@ -357,11 +532,34 @@ static int mask2bits(uint32_t netmask)
 	return bits;
 }
 
+static int mask6bits(uint8_t *netmask)
+{
+	int i, bits = 0;
+
+	for (i = 0; i < 16 && netmask[i] == 0xff; i++)
+		bits += 8;
+
+	if (i == 16)
+		return bits;
+
+	for (; netmask[i] & 0x80; netmask[i] <<= 1)
+		bits++;
+
+	/* the rest of a valid netmask must be zero */
+	for (; i < 16; i++) {
+		if (netmask[i] != 0)
+			return -1;
+	}
+
+	return bits;
+}
+
 static int get_netmask(unsigned *val, const char *addr)
 {
 	char *ptr;
 	unsigned long res;
 	uint32_t data;
+	uint8_t data6[16];
 	int b;
 
 	res = strtoul(addr, &ptr, 0);
@@ -379,10 +577,18 @@ static int get_netmask(unsigned *val, const char *addr)
 	return 0;
 
 get_addr:
-	if (get_addr_ipv4((uint8_t *)&data, addr) <= 0)
-		return -1;
+	if (strchr(addr, ':')) {
+		if (inet_pton(AF_INET6, addr, data6) <= 0)
+			return -1;
+
+		b = mask6bits(data6);
+	} else {
+		if (get_addr_ipv4((uint8_t *)&data, addr) <= 0)
+			return -1;
+
+		b = mask2bits(data);
+	}
 
-	b = mask2bits(data);
 	if (b < 0)
 		return -1;
 
@@ -390,272 +596,507 @@ get_addr:
 	return 0;
 }
 
-static int hyper_setup_route(struct rtnl_handle *rth,
-			   struct hyper_route *rt)
+/*
+ * Parse an ipv4 or ipv6 address, optionally followed by "/prefixlen".
+ * Without prefix length, the bitlen is the full address length.
+ */
+static int get_prefix(inet_prefix *dst, const char *arg)
 {
-	uint32_t data;
-	struct {
-		struct nlmsghdr n;
-		struct rtmsg r;
-		char buf[1024];
-	} req;
+	char addr[INET6_ADDRSTRLEN + 8];
+	unsigned bits;
+	char *slash;
 
-	if (!rt->dst) {
-		fprintf(stderr, "route dest is null\n");
+	if (snprintf(addr, sizeof(addr), "%s", arg) >= sizeof(addr))
 		return -1;
-	}
 
-	memset(&req, 0, sizeof(req));
-	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-	req.n.nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL | NLM_F_REQUEST;
-	req.n.nlmsg_type = RTM_NEWROUTE;
+	memset(dst, 0, sizeof(*dst));
 
-	req.r.rtm_family = AF_INET;
-	req.r.rtm_table = RT_TABLE_MAIN;
-	req.r.rtm_scope = RT_SCOPE_UNIVERSE;
-	req.r.rtm_type = RTN_UNICAST;
-	req.r.rtm_protocol = RTPROT_BOOT;
-	req.r.rtm_dst_len = 0;
+	slash = strchr(addr, '/');
+	if (slash)
+		*slash = '\0';
 
-	if (rt->gw) {
-		if (get_addr_ipv4((uint8_t *)&data, rt->gw) <= 0) {
-			fprintf(stderr, "get gw failed\n");
+	if (strchr(addr, ':')) {
+		dst->family = AF_INET6;
+		dst->bytelen = 16;
+		if (inet_pton(AF_INET6, addr, dst->data) <= 0)
 			return -1;
-		}
-
-		if (addattr_l(&req.n, sizeof(req), RTA_GATEWAY, &data, 4)) {
-			fprintf(stderr, "setup gateway attr failed\n");
+	} else {
+		dst->family = AF_INET;
+		dst->bytelen = 4;
+		if (get_addr_ipv4((uint8_t *)dst->data, addr) <= 0)
 			return -1;
-		}
 	}
 
-	if (rt->device) {
-		rt->ifindex = hyper_get_ifindex(rt->device);
-		if (addattr_l(&req.n, sizeof(req), RTA_OIF, &rt->ifindex, 4)) {
-			fprintf(stderr, "setup oif attr failed\n");
+	dst->bitlen = dst->bytelen * 8;
+	if (slash) {
+		if (get_netmask(&bits, slash + 1) < 0 || bits > dst->bitlen)
 			return -1;
-		}
+		dst->bitlen = bits;
+		dst->flags |= 1;
 	}
 
-	if (strcmp(rt->dst, "default") && strcmp(rt->dst, "any") && strcmp(rt->dst, "all")) {
-		unsigned mask;
-		char *slash = strchr(rt->dst, '/');
+	return 0;
+}
 
-		req.r.rtm_dst_len = 32;
+struct hyper_route_req {
+	struct nlmsghdr n;
+	struct rtmsg r;
+	char buf[1024];
+};
 
-		if (slash)
-			*slash = 0;
+struct hyper_addr_req {
+	struct nlmsghdr n;
+	struct ifaddrmsg ifa;
+	char buf[256];
+};
 
-		if (get_addr_ipv4((uint8_t *)&data, rt->dst) <= 0) {
-			fprintf(stderr, "get dst failed\n");
-			return -1;
-		}
+/* send several requests in a single sendmsg(), the kernel handles them in order */
+static int rtnl_talk_batch(struct rtnl_handle *rtnl, struct nlmsghdr **n, int num)
+{
+	int i, status;
+	struct sockaddr_nl nladdr;
+	struct iovec *iov;
+	struct msghdr msg = { (void *)&nladdr, sizeof(nladdr), NULL, num, NULL, 0, 0 };
 
-		if (addattr_l(&req.n, sizeof(req), RTA_DST, &data, 4)) {
-			fprintf(stderr, "setup gateway attr failed\n");
-			return -1;
-		}
+	if (num == 0)
+		return 0;
 
-		if (slash) {
-			if (get_netmask(&mask, slash + 1) < 0) {
-				fprintf(stderr, "get netmask failed\n");
-				return -1;
-			}
-			req.r.rtm_dst_len = mask;
-			*slash = '/';
-		}
+	iov = calloc(num, sizeof(*iov));
+	if (iov == NULL) {
+		fprintf(stderr, "allocate iovec for netlink batch failed\n");
+		return -1;
 	}
 
-	if (rtnl_talk(rth, &req.n, 0, 0, NULL) < 0) {
-		fprintf(stderr, "rtnl talk failed\n");
-		return -1;
+	for (i = 0; i < num; i++) {
+		n[i]->nlmsg_seq = ++rtnl->seq;
+		n[i]->nlmsg_flags |= NLM_F_ACK;
+		iov[i].iov_base = n[i];
+		iov[i].iov_len = NLMSG_ALIGN(n[i]->nlmsg_len);
 	}
 
-	return 0;
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+	msg.msg_iov = iov;
+
+	status = sendmsg(rtnl->fd, &msg, 0);
+	free(iov);
+
+	return status < 0 ? -1 : 0;
 }
 
-static int hyper_cleanup_route(struct rtnl_handle *rth, struct hyper_route *rt)
+static int hyper_build_route(struct rtnl_handle *rth, struct hyper_route *rt,
+			     struct hyper_route_req *req, int cmd)
 {
-	uint32_t data;
-	struct {
-		struct nlmsghdr n;
-		struct rtmsg r;
-		char buf[1024];
-	} req;
+	inet_prefix gw, dst;
 
 	if (!rt->dst) {
 		fprintf(stderr, "route dest is null\n");
 		return -1;
 	}
 
-	memset(&req, 0, sizeof(req));
-	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-	req.n.nlmsg_flags = NLM_F_REQUEST;
-	req.n.nlmsg_type = RTM_DELROUTE;
+	memset(req, 0, sizeof(*req));
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST;
+	req->n.nlmsg_type = cmd;
+	if (cmd == RTM_NEWROUTE)
+		req->n.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
 
-	req.r.rtm_family = AF_INET;
-	req.r.rtm_table = RT_TABLE_MAIN;
-	req.r.rtm_scope = RT_SCOPE_UNIVERSE;
-	req.r.rtm_type = RTN_UNICAST;
-	req.r.rtm_protocol = RTPROT_BOOT;
-	req.r.rtm_dst_len = 0;
+	req->r.rtm_family = AF_INET;
+	req->r.rtm_table = RT_TABLE_MAIN;
+	req->r.rtm_scope = RT_SCOPE_UNIVERSE;
+	req->r.rtm_type = RTN_UNICAST;
+	req->r.rtm_protocol = RTPROT_BOOT;
+	req->r.rtm_dst_len = 0;
 
 	if (rt->gw) {
-		if (get_addr_ipv4((uint8_t *)&data, rt->gw) <= 0) {
+		if (get_prefix(&gw, rt->gw) < 0) {
 			fprintf(stderr, "get gw failed\n");
 			return -1;
 		}
 
-		if (addattr_l(&req.n, sizeof(req), RTA_GATEWAY, &data, 4)) {
+		req->r.rtm_family = gw.family;
+		if (addattr_l(&req->n, sizeof(*req), RTA_GATEWAY, gw.data, gw.bytelen)) {
 			fprintf(stderr, "setup gateway attr failed\n");
 			return -1;
 		}
 	}
 
 	if (rt->device) {
-		if (addattr_l(&req.n, sizeof(req), RTA_OIF, &rt->ifindex, 4)) {
+		if (cmd == RTM_NEWROUTE) {
+			rt->ifindex = hyper_get_ifindex(rth, rt->device);
+			if (rt->ifindex < 0) {
+				fprintf(stderr, "get ifindex of %s failed\n", rt->device);
+				return -1;
+			}
+		}
+
+		if (addattr_l(&req->n, sizeof(*req), RTA_OIF, &rt->ifindex, 4)) {
 			fprintf(stderr, "setup oif attr failed\n");
 			return -1;
 		}
 	}
 
 	if (strcmp(rt->dst, "default") && strcmp(rt->dst, "any") && strcmp(rt->dst, "all")) {
-		unsigned mask;
-		char *slash = strchr(rt->dst, '/');
-
-		req.r.rtm_dst_len = 32;
-
-		if (slash)
-			*slash = 0;
-
-		if (get_addr_ipv4((uint8_t *)&data, rt->dst) <= 0) {
+		if (get_prefix(&dst, rt->dst) < 0) {
 			fprintf(stderr, "get dst failed\n");
 			return -1;
 		}
 
-		if (addattr_l(&req.n, sizeof(req), RTA_DST, &data, 4)) {
-			fprintf(stderr, "setup gateway attr failed\n");
+		if (rt->gw && dst.family != req->r.rtm_family) {
+			fprintf(stderr, "route dst %s and gw %s are different families\n",
+				rt->dst, rt->gw);
 			return -1;
 		}
 
-		if (slash) {
-			if (get_netmask(&mask, slash + 1) < 0) {
-				fprintf(stderr, "get netmask failed\n");
-				return -1;
-			}
-			req.r.rtm_dst_len = mask;
-			*slash = '/';
+		req->r.rtm_family = dst.family;
+		req->r.rtm_dst_len = dst.bitlen;
+		if (addattr_l(&req->n, sizeof(*req), RTA_DST, dst.data, dst.bytelen)) {
+			fprintf(stderr, "setup dst attr failed\n");
+			return -1;
 		}
 	}
 
-	if (rtnl_talk(rth, &req.n, 0, 0, NULL) < 0) {
-		fprintf(stderr, "rtnl talk failed\n");
-		return -1;
-	}
-
 	return 0;
 }
 
-static int hyper_setup_interface(struct rtnl_handle *rth,
-			       struct hyper_interface *iface)
+static int hyper_talk_routes(struct rtnl_handle *rth, struct hyper_route *rts,
+			     int num, int cmd)
 {
-	uint8_t data[4];
-	unsigned mask;
-	struct {
-		struct nlmsghdr n;
-		struct ifaddrmsg ifa;
-		char buf[256];
-	} req;
+	struct hyper_route_req *reqs;
+	struct nlmsghdr **msgs;
+	int i, n = 0, ret = -1;
+
+	reqs = calloc(num, sizeof(*reqs));
+	msgs = calloc(num, sizeof(*msgs));
+	if (reqs == NULL || msgs == NULL) {
+		fprintf(stderr, "allocate route requests failed\n");
+		goto out;
+	}
 
-	if (!(iface->device && iface->ipaddr && iface->mask)) {
-		fprintf(stderr, "interface information incorrect\n");
-		return -1;
+	/* setup fails as a whole, cleanup removes every route it can */
+	for (i = 0; i < num; i++) {
+		if (hyper_build_route(rth, &rts[i], &reqs[n], cmd) < 0) {
+			if (cmd != RTM_DELROUTE)
+				goto out;
+			fprintf(stderr, "skip cleanup of route %d\n", i);
+			continue;
+		}
+		msgs[n] = &reqs[n].n;
+		n++;
 	}
 
-	memset(&req, 0, sizeof(req));
-	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
-	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL;
-	req.n.nlmsg_type = RTM_NEWADDR;
-	req.ifa.ifa_family = AF_INET;
+	if (rtnl_talk_batch(rth, msgs, n) < 0) {
+		fprintf(stderr, "rtnl talk failed\n");
+		goto out;
+	}
+
+	ret = 0;
+out:
+	free(msgs);
+	free(reqs);
+	return ret;
+}
 
-	iface->ifindex = hyper_get_ifindex(iface->device);
-	req.ifa.ifa_index = iface->ifindex;
-	req.ifa.ifa_scope = 0;
+static int hyper_setup_routes(struct rtnl_handle *rth, struct hyper_route *rts, int num)
+{
+	return hyper_talk_routes(rth, rts, num, RTM_NEWROUTE);
+}
 
-	if (get_addr_ipv4((uint8_t *)&data, iface->ipaddr) <= 0) {
-		fprintf(stderr, "get addr failed\n");
+static int hyper_cleanup_routes(struct rtnl_handle *rth, struct hyper_route *rts, int num)
+{
+	return hyper_talk_routes(rth, rts, num, RTM_DELROUTE);
+}
+
+static int hyper_build_addr(struct hyper_interface *iface, struct hyper_ipaddress *ip,
+			    struct hyper_addr_req *req, int cmd)
+{
+	inet_prefix addr;
+	unsigned mask;
+
+	if (!ip->addr) {
+		fprintf(stderr, "interface %s address is null\n", iface->device);
 		return -1;
 	}
 
-	if (addattr_l(&req.n, sizeof(req), IFA_LOCAL, &data, 4)) {
-		fprintf(stderr, "setup attr failed\n");
+	if (get_prefix(&addr, ip->addr) < 0) {
+		fprintf(stderr, "get addr %s failed\n", ip->addr);
 		return -1;
 	}
 
-	if (get_netmask(&mask, iface->mask) < 0) {
+	mask = addr.bitlen;
+	if (ip->mask && get_netmask(&mask, ip->mask) < 0) {
 		fprintf(stderr, "get netamsk failed\n");
 		return -1;
 	}
 
-	req.ifa.ifa_prefixlen = mask;
-	fprintf(stdout, "interface get netamsk %d %s\n", req.ifa.ifa_prefixlen, iface->mask);
-	if (rtnl_talk(rth, &req.n, 0, 0, NULL) < 0) {
-		perror("rtnl_talk failed");
+	if (mask > addr.bytelen * 8) {
+		fprintf(stderr, "netmask %s is too long for %s\n", ip->mask, ip->addr);
 		return -1;
 	}
 
-	if (hyper_up_nic(rth, iface->ifindex) < 0) {
-		fprintf(stderr, "up device %d failed\n", iface->ifindex);
+	memset(req, 0, sizeof(*req));
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST;
+	req->n.nlmsg_type = cmd;
+	if (cmd == RTM_NEWADDR)
+		req->n.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+
+	req->ifa.ifa_family = addr.family;
+	req->ifa.ifa_index = iface->ifindex;
+	req->ifa.ifa_scope = 0;
+	req->ifa.ifa_prefixlen = mask;
+	/* the host has assigned the address, skip the duplicate detection */
+	if (addr.family == AF_INET6)
+		req->ifa.ifa_flags |= IFA_F_NODAD;
+
+	if (addattr_l(&req->n, sizeof(*req), IFA_LOCAL, addr.data, addr.bytelen)) {
+		fprintf(stderr, "setup attr failed\n");
 		return -1;
 	}
 
+	fprintf(stdout, "interface %s address %s prefixlen %d\n",
+		iface->device, ip->addr, req->ifa.ifa_prefixlen);
 	return 0;
 }
 
-static int hyper_cleanup_interface(struct rtnl_handle *rth,
-				 struct hyper_interface *iface)
+static int hyper_talk_addrs(struct rtnl_handle *rth, struct hyper_interface *iface, int cmd)
+{
+	struct hyper_addr_req *reqs;
+	struct nlmsghdr **msgs;
+	int i, ret = -1;
+
+	reqs = calloc(iface->ipaddr_num, sizeof(*reqs));
+	msgs = calloc(iface->ipaddr_num, sizeof(*msgs));
+	if (reqs == NULL || msgs == NULL) {
+		fprintf(stderr, "allocate address requests failed\n");
+		goto out;
+	}
+
+	for (i = 0; i < iface->ipaddr_num; i++) {
+		if (hyper_build_addr(iface, &iface->ipaddrs[i], &reqs[i], cmd) < 0)
+			goto out;
+		msgs[i] = &reqs[i].n;
+	}
+
+	if (rtnl_talk_batch(rth, msgs, iface->ipaddr_num) < 0) {
+		perror("rtnl_talk failed");
+		goto out;
+	}
+
+	ret = 0;
+out:
+	free(msgs);
+	free(reqs);
+	return ret;
+}
+
+static int hyper_setup_link(struct rtnl_handle *rth, struct hyper_interface *iface)
 {
-	uint8_t data[4];
-	unsigned mask;
 	struct {
 		struct nlmsghdr n;
-		struct ifaddrmsg ifa;
+		struct ifinfomsg i;
 		char buf[256];
 	} req;
 
-	if (!(iface->device && iface->ipaddr && iface->mask)) {
+	if (iface->mtu == 0 && iface->txqueuelen == 0)
+		return 0;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_NEWLINK;
+	req.i.ifi_family = AF_UNSPEC;
+	req.i.ifi_index = iface->ifindex;
+
+	if (iface->mtu > 0 &&
+	    addattr_l(&req.n, sizeof(req), IFLA_MTU, &iface->mtu, 4)) {
+		fprintf(stderr, "setup mtu attr failed\n");
+		return -1;
+	}
+
+	if (iface->txqueuelen > 0 &&
+	    addattr_l(&req.n, sizeof(req), IFLA_TXQLEN, &iface->txqueuelen, 4)) {
+		fprintf(stderr, "setup txqueuelen attr failed\n");
+		return -1;
+	}
+
+	fprintf(stdout, "interface %s mtu %u txqueuelen %u\n",
+		iface->device, iface->mtu, iface->txqueuelen);
+
+	if (rtnl_talk(rth, &req.n, 0, 0, NULL) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* enable multiple virtio-net queue pairs, same as `ethtool -L dev combined n` */
+static int hyper_setup_channels(struct hyper_interface *iface)
+{
+	struct ethtool_channels ch = { .cmd = ETHTOOL_GCHANNELS };
+	struct ifreq ifr;
+	int fd, ret = -1;
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("create ethtool socket failed");
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, iface->device, IFNAMSIZ - 1);
+	ifr.ifr_data = (void *)&ch;
+
+	/* the queue count is only tuning, keep going without channel support */
+	if (ioctl(fd, SIOCETHTOOL, &ifr) < 0) {
+		perror("get channels failed");
+		if (errno == EOPNOTSUPP || errno == EINVAL)
+			ret = 0;
+		goto out;
+	}
+
+	if (iface->queues > ch.max_combined) {
+		fprintf(stdout, "%s supports %u queues at most, %u requested\n",
+			iface->device, ch.max_combined, iface->queues);
+		iface->queues = ch.max_combined;
+	}
+
+	if (iface->queues == 0 || iface->queues == ch.combined_count) {
+		ret = 0;
+		goto out;
+	}
+
+	ch.cmd = ETHTOOL_SCHANNELS;
+	ch.combined_count = iface->queues;
+	if (ioctl(fd, SIOCETHTOOL, &ifr) < 0) {
+		perror("set channels failed");
+		if (errno == EOPNOTSUPP || errno == EINVAL)
+			ret = 0;
+		goto out;
+	}
+
+	fprintf(stdout, "interface %s uses %u queues\n", iface->device, iface->queues);
+	ret = 0;
+out:
+	close(fd);
+	return ret;
+}
+
+/* format a cpu bitmap the way /sys/class/net/<dev>/queues/ expects it */
+static void hyper_cpumask_str(char *buf, uint32_t *mask, int words)
+{
+	int i;
+
+	for (i = words - 1; i >= 0; i--)
+		buf += sprintf(buf, i ? "%08x," : "%08x", mask[i]);
+}
+
+/*
+ * Spread transmit queues over the cpus, cpu c sends on queue c % queues, so
+ * a packet is queued on the cpu that sent it without contending for a lock.
+ * rpsCpus, if given, is written to every rx queue as is.
+ */
+static int hyper_setup_queues(struct hyper_interface *iface)
+{
+	char path[256], *mask;
+	uint32_t *words;
+	int c, q, ncpus, nwords, ret = -1;
+
+	ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (ncpus <= 0)
+		ncpus = 1;
+	nwords = (ncpus + 31) / 32;
+
+	words = calloc(nwords, sizeof(*words));
+	mask = malloc(nwords * 9 + 1);
+	if (words == NULL || mask == NULL) {
+		fprintf(stderr, "allocate cpu mask failed\n");
+		goto out;
+	}
+
+	for (q = 0; iface->queues > 1 && q < iface->queues; q++) {
+		memset(words, 0, nwords * sizeof(*words));
+		for (c = q; c < ncpus; c += iface->queues)
+			words[c / 32] |= 1U << (c % 32);
+
+		/* more queues than cpus, leave the spare ones unmapped */
+		hyper_cpumask_str(mask, words, nwords);
+		sprintf(path, "/sys/class/net/%s/queues/tx-%d/xps_cpus", iface->device, q);
+		if (hyper_write_file(path, mask, strlen(mask)) < 0) {
+			fprintf(stderr, "write %s to %s failed\n", mask, path);
+			goto out;
+		}
+	}
+
+	for (q = 0; iface->rps_cpus != NULL; q++) {
+		sprintf(path, "/sys/class/net/%s/queues/rx-%d/rps_cpus", iface->device, q);
+		if (access(path, F_OK) < 0)
+			break;
+
+		if (hyper_write_file(path, iface->rps_cpus, strlen(iface->rps_cpus)) < 0) {
+			fprintf(stderr, "write %s to %s failed\n", iface->rps_cpus, path);
+			goto out;
+		}
+	}
+
+	ret = 0;
+out:
+	free(words);
+	free(mask);
+	return ret;
+}
+
+static int hyper_setup_interface(struct rtnl_handle *rth,
+			       struct hyper_interface *iface)
+{
+	if (!(iface->device && iface->ipaddr_num > 0)) {
 		fprintf(stderr, "interface information incorrect\n");
 		return -1;
 	}
 
-	memset(&req, 0, sizeof(req));
-	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
-	req.n.nlmsg_flags = NLM_F_REQUEST;
-	req.n.nlmsg_type = RTM_DELADDR;
-	req.ifa.ifa_family = AF_INET;
+	iface->ifindex = hyper_wait_ifindex(rth, iface->device, HYPER_NIC_TIMEOUT);
+	if (iface->ifindex < 0) {
+		fprintf(stderr, "get ifindex of %s failed\n", iface->device);
+		return -1;
+	}
 
-	req.ifa.ifa_index = iface->ifindex;
-	req.ifa.ifa_scope = 0;
+	if (hyper_setup_link(rth, iface) < 0) {
+		fprintf(stderr, "setup link of %s failed\n", iface->device);
+		return -1;
+	}
 
-	if (get_addr_ipv4((uint8_t *)&data, iface->ipaddr) <= 0) {
-		fprintf(stderr, "get addr failed\n");
+	if (iface->queues > 0 && hyper_setup_channels(iface) < 0) {
+		fprintf(stderr, "setup queues of %s failed\n", iface->device);
 		return -1;
 	}
 
-	if (addattr_l(&req.n, sizeof(req), IFA_LOCAL, &data, 4)) {
-		fprintf(stderr, "setup attr failed\n");
+	if (hyper_talk_addrs(rth, iface, RTM_NEWADDR) < 0) {
+		fprintf(stderr, "setup addresses of %s failed\n", iface->device);
 		return -1;
 	}
 
-	if (get_netmask(&mask, iface->mask) < 0) {
-		fprintf(stderr, "get netamsk failed\n");
+	if (hyper_up_nic(rth, iface->ifindex) < 0) {
+		fprintf(stderr, "up device %d failed\n", iface->ifindex);
 		return -1;
 	}
 
-	req.ifa.ifa_prefixlen = mask;
-	fprintf(stdout, "interface get netamsk %d %s\n", req.ifa.ifa_prefixlen, iface->mask);
-	if (rtnl_talk(rth, &req.n, 0, 0, NULL) < 0) {
-		perror("rtnl_talk failed");
+	if ((iface->queues > 1 || iface->rps_cpus) && hyper_setup_queues(iface) < 0) {
+		fprintf(stderr, "setup queue cpus of %s failed\n", iface->device);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int hyper_cleanup_interface(struct rtnl_handle *rth,
+				 struct hyper_interface *iface)
+{
+	if (!(iface->device && iface->ipaddr_num > 0)) {
+		fprintf(stderr, "interface information incorrect\n");
+		return -1;
+	}
+
+	if (hyper_talk_addrs(rth, iface, RTM_DELADDR) < 0) {
+		fprintf(stderr, "cleanup addresses of %s failed\n", iface->device);
 		return -1;
 	}
 
@@ -677,6 +1118,25 @@ static int hyper_cleanup_interface(struct rtnl_handle *rth,
 	return 0;
 }
 
+void hyper_free_interface(struct hyper_interface *iface)
+{
+	int i;
+
+	for (i = 0; i < iface->ipaddr_num; i++) {
+		free(iface->ipaddrs[i].addr);
+		free(iface->ipaddrs[i].mask);
+	}
+
+	free(iface->ipaddrs);
+	iface->ipaddrs = NULL;
+	iface->ipaddr_num = 0;
+
+	free(iface->device);
+	iface->device = NULL;
+	free(iface->rps_cpus);
+	iface->rps_cpus = NULL;
+}
+
 int hyper_rescan(void)
 {
 	int fd = open("/sys/bus/pci/rescan", O_WRONLY);
@@ -700,14 +1160,16 @@ int hyper_setup_network(struct hyper_pod *pod)
 {
 	int i, ret = 0;
 	struct hyper_interface *iface;
-	struct hyper_route *rt;
 	struct rtnl_handle rth;
 
-	if (hyper_rescan() < 0)
+	/* subscribe link events before rescan, so no new nic is missed */
+	if (netlink_open(&rth, RTMGRP_LINK) < 0)
 		return -1;
 
-	if (netlink_open(&rth) < 0)
-		return -1;
+	if (hyper_rescan() < 0) {
+		ret = -1;
+		goto out;
+	}
 
 	for (i = 0; i < pod->i_num; i++) {
 		iface = &pod->iface[i];
@@ -725,14 +1187,10 @@ int hyper_setup_network(struct hyper_pod *pod)
 		goto out;
 	}
 
-	for (i = 0; i < pod->r_num; i++) {
-		rt = &pod->rt[i];
-
-		ret = hyper_setup_route(&rth, rt);
-		if (ret < 0) {
-			fprintf(stderr, "setup route failed\n");
-			goto out;
-		}
+	ret = hyper_setup_routes(&rth, pod->rt, pod->r_num);
+	if (ret < 0) {
+		fprintf(stderr, "setup route failed\n");
+		goto out;
 	}
 
 out:
@@ -747,17 +1205,17 @@ void hyper_cleanup_network(struct hyper_pod *pod)
 	struct hyper_interface *iface;
 	struct hyper_route *rt;
 
-	if (netlink_open(&rth) < 0) {
+	if (netlink_open(&rth, 0) < 0) {
 		fprintf(stdout, "open netlink failed\n");
 		return;
 	}
 
+	if (hyper_cleanup_routes(&rth, pod->rt, pod->r_num) < 0)
+		fprintf(stderr, "cleanup route failed\n");
+
 	for (i = 0; i < pod->r_num; i++) {
 		rt = &pod->rt[i];
 
-		if (hyper_cleanup_route(&rth, rt) < 0)
-			fprintf(stderr, "cleanup route failed\n");
-
 		free(rt->dst);
 		free(rt->gw);
 		free(rt->device);
@@ -773,9 +1231,7 @@ void hyper_cleanup_network(struct hyper_pod *pod)
 		if (hyper_cleanup_interface(&rth, iface) < 0)
 			fprintf(stderr, "link down device %s failed\n", iface->device);
 
-		free(iface->device);
-		free(iface->ipaddr);
-		free(iface->mask);
+		hyper_free_interface(iface);
 	}
 
 	free(pod->iface);
@@ -790,12 +1246,12 @@ int hyper_cmd_setup_interface(char *json, int length)
 	struct hyper_interface *iface;
 	struct rtnl_handle rth;
 
-	if (hyper_rescan() < 0)
-		return -1;
-
-	if (netlink_open(&rth) < 0)
+	/* subscribe link events before rescan, so no new nic is missed */
+	if (netlink_open(&rth, RTMGRP_LINK) < 0)
 		return -1;
 
+	if (hyper_rescan() < 0)
+		goto out;
 
 	iface = hyper_parse_setup_interface(json, length);
 	if (iface == NULL) {
@@ -809,9 +1265,7 @@ int hyper_cmd_setup_interface(char *json, int length)
 	}
 	ret = 0;
 out1:
-	free(iface->device);
-	free(iface->ipaddr);
-	free(iface->mask);
+	hyper_free_interface(iface);
 	free(iface);
 out:
 	netlink_close(&rth);
@@ -824,7 +1278,7 @@ int hyper_cmd_setup_route(char *json, int length) {
 	uint32_t r_num;
 	struct rtnl_handle rth;
 
-	if (netlink_open(&rth) < 0)
+	if (netlink_open(&rth, 0) < 0)
 		return -1;
 
 	if (hyper_parse_setup_routes(&rts, &r_num, json, length) < 0) {
@@ -832,17 +1286,19 @@ int hyper_cmd_setup_route(char *json, int length) {
 		goto out;
 	}
 
-	for (i = 0; i < r_num; i++) {
-		ret = hyper_setup_route(&rth, &rts[i]);
-		if (ret < 0) {
-			fprintf(stderr, "setup route failed\n");
-			goto out;
-		}
+	if (hyper_setup_routes(&rth, rts, r_num) < 0) {
+		fprintf(stderr, "setup route failed\n");
+		goto out;
 	}
 
 	ret = 0;
 out:
 	netlink_close(&rth);
+	for (i = 0; rts && i < r_num; i++) {
+		free(rts[i].dst);
+		free(rts[i].gw);
+		free(rts[i].device);
+	}
 	free(rts);
 	return ret;
 }
@@ -850,7 +1306,7 @@ out:
 int hyper_setup_dns(struct hyper_pod *pod)
 {
 	int i, fd, ret = -1;
-	char buf[28];
+	char buf[64];
 
 	if (pod->dns == NULL)
 		return 0;
@@ -10,12 +10,24 @@
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
+/* how long to wait for a hot-plugged nic to be registered, in ms */
+#define HYPER_NIC_TIMEOUT	10000
+
+struct hyper_link {
+	char	name[IFNAMSIZ];
+	int	ifindex;
+};
+
 struct rtnl_handle {
 	int fd;
 	struct sockaddr_nl local;
 	struct sockaddr_nl peer;
 	__u32 seq;
 	__u32 dump;
+	/* name -> ifindex cache, filled by RTM_GETLINK dump and link events */
+	struct hyper_link *links;
+	int l_num;
+	int l_dumped;
 };
 
 typedef struct {
@@ -26,13 +38,23 @@ typedef struct {
 	__u32 data[8];
 } inet_prefix;
 
-struct hyper_interface {
-	char		*device;
-	int		ifindex;
-	char		*ipaddr;
+struct hyper_ipaddress {
+	char		*addr;
 	char		*mask;
 };
 
+struct hyper_interface {
+	char			*device;
+	int			ifindex;
+	struct hyper_ipaddress	*ipaddrs;
+	int			ipaddr_num;
+	/* optional link tuning, 0/NULL keeps the kernel default */
+	uint32_t		mtu;
+	uint32_t		txqueuelen;
+	uint32_t		queues;
+	char			*rps_cpus;
+};
+
 struct hyper_route {
 	char		*dst;
 	char		*gw;
@@ -47,6 +69,7 @@ uint32_t hyper_get_be32(uint8_t *buf);
 void hyper_set_be64(uint8_t *buf, uint64_t val);
 uint64_t hyper_get_be64(uint8_t *buf);
 int hyper_setup_network(struct hyper_pod *pod);
+void hyper_free_interface(struct hyper_interface *iface);
 int hyper_cmd_setup_interface(char *json, int length);
 int hyper_cmd_setup_route(char *json, int length);
 void hyper_cleanup_network(struct hyper_pod *pod);
@@ -227,6 +227,7 @@ static void container_free_volumes(struct hyper_container *c)
 		free(c->vols[i].mountpoint);
 		free(c->vols[i].fstype);
 		free(c->vols[i].scsiaddr);
+		free(c->vols[i].pciaddr);
 	}
 	free(c->vols);
 	c->vols = NULL;
@@ -269,6 +270,9 @@ static int container_parse_volumes(struct hyper_container *c, char *json, jsmnto
 			} else if (json_token_streq(json, &toks[i], "addr")) {
 				c->vols[j].scsiaddr = (json_token_str(json, &toks[++i]));
 				fprintf(stdout, "volume %d scsi id %s\n", j, c->vols[j].scsiaddr);
+			} else if (json_token_streq(json, &toks[i], "pciAddr")) {
+				c->vols[j].pciaddr = (json_token_str(json, &toks[++i]));
+				fprintf(stdout, "volume %d pci address %s\n", j, c->vols[j].pciaddr);
 			} else if (json_token_streq(json, &toks[i], "mount")) {
 				c->vols[j].mountpoint =
 				(json_token_str(json, &toks[++i]));
@@ -285,6 +289,13 @@ static int container_parse_volumes(struct hyper_container *c, char *json, jsmnto
 				if (!json_token_streq(json, &toks[++i], "false"))
 					c->vols[j].docker = 1;
 				fprintf(stdout, "volume %d docker volume %d\n", j, c->vols[j].docker);
+			} else if (json_token_streq(json, &toks[i], "populate")) {
+				i++;
+				if (json_token_streq(json, &toks[i], "lazy"))
+					c->vols[j].populate = POPULATE_LAZY;
+				else if (json_token_streq(json, &toks[i], "background"))
+					c->vols[j].populate = POPULATE_BACKGROUND;
+				fprintf(stdout, "volume %d populate %d\n", j, c->vols[j].populate);
 			} else {
 				fprintf(stdout, "get unknown section %s in voulmes\n",
 					json_token_str(json, &toks[i]));
@@ -516,6 +527,23 @@ static int hyper_parse_process(struct hyper_exec *exec, char *json, jsmntok_t *t
 			exec->workdir = (json_token_str(json, &toks[++i]));
 			fprintf(stdout, "container workdir %s\n", exec->workdir);
 			i++;
+		} else if (json_token_streq(json, t, "flowControl") && t->size == 1) {
+			if (!json_token_streq(json, &toks[++i], "false"))
+				exec->flow_control = 1;
+			fprintf(stdout, "container process flow control %d\n", exec->flow_control);
+			i++;
+		} else if (json_token_streq(json, t, "capture") && t->size == 1) {
+			int64_t capture = json_token_ll(json, &toks[++i]);
+
+			/* 0 streams the output as usual */
+			if (capture < 0) {
+				fprintf(stderr, "invalid capture size %" PRId64 "\n", capture);
+				return -1;
+			}
+			exec->capture = capture > HYPER_EXEC_CAPTURE_MAX ?
+					HYPER_EXEC_CAPTURE_MAX : capture;
+			fprintf(stdout, "container process capture %" PRIu32 "\n", exec->capture);
+			i++;
 		}
 	}
 
@@ -601,6 +629,8 @@ void hyper_free_container(struct hyper_container *c)
 
 	free(c->scsiaddr);
 	c->scsiaddr = NULL;
+	free(c->pciaddr);
+	c->pciaddr = NULL;
 
 	free(c->fstype);
 	c->fstype = NULL;
@@ -610,6 +640,9 @@ void hyper_free_container(struct hyper_container *c)
 	container_free_sysctl(c);
 	container_free_fsmap(c);
 	container_cleanup_exec(&c->exec);
+	hyper_free_user_cache(c->users);
+	hyper_free_exec_env(c->env);
+	hyper_free_exec_paths(c->exec_paths);
 
 	list_del_init(&c->list);
 	free(c);
@@ -642,6 +675,7 @@ static int hyper_parse_container(struct hyper_pod *pod, struct hyper_container *
 	c->exec.stdinfd = -1;
 	c->exec.stdoutfd = -1;
 	c->exec.stderrfd = -1;
+	c->exec.pidfd = -1;
 	c->ns = -1;
 	INIT_LIST_HEAD(&c->list);
 
@@ -668,6 +702,10 @@ static int hyper_parse_container(struct hyper_pod *pod, struct hyper_container *
 			c->scsiaddr = (json_token_str(json, &toks[++i]));
 			fprintf(stdout, "container image scsi id %s\n", c->scsiaddr);
 			i++;
+		} else if (json_token_streq(json, t, "pciAddr") && t->size == 1) {
+			c->pciaddr = (json_token_str(json, &toks[++i]));
+			fprintf(stdout, "container image pci address %s\n", c->pciaddr);
+			i++;
 		} else if (json_token_streq(json, t, "fstype") && t->size == 1) {
 			c->fstype = (json_token_str(json, &toks[++i]));
 			fprintf(stdout, "container fstype %s\n", c->fstype);
@@ -753,10 +791,84 @@ fail:
 	return -1;
 }
 
+static int hyper_add_ipaddress(struct hyper_interface *iface, char *addr, char *mask)
+{
+	struct hyper_ipaddress *ipaddrs;
+
+	ipaddrs = realloc(iface->ipaddrs, (iface->ipaddr_num + 1) * sizeof(*ipaddrs));
+	if (ipaddrs == NULL) {
+		fprintf(stderr, "alloc memory for ip address failed\n");
+		return -1;
+	}
+
+	ipaddrs[iface->ipaddr_num].addr = addr;
+	ipaddrs[iface->ipaddr_num].mask = mask;
+	iface->ipaddrs = ipaddrs;
+	iface->ipaddr_num++;
+
+	return 0;
+}
+
+static int hyper_parse_ipaddresses(struct hyper_interface *iface,
+				   char *json, jsmntok_t *toks)
+{
+	int i = 0, j, k, num, next_ip;
+	char *addr, *mask;
+
+	if (toks[i].type != JSMN_ARRAY) {
+		fprintf(stdout, "ipAddresses need array\n");
+		return -1;
+	}
+
+	num = toks[i].size;
+
+	i++;
+	for (j = 0; j < num; j++) {
+		if (toks[i].type != JSMN_OBJECT) {
+			fprintf(stdout, "ipAddresses array need object\n");
+			return -1;
+		}
+		next_ip = toks[i].size;
+		addr = mask = NULL;
+
+		i++;
+		for (k = 0; k < next_ip; k++, i++) {
+			if (json_token_streq(json, &toks[i], "ipAddress")) {
+				free(addr);
+				addr = (json_token_str(json, &toks[++i]));
+				fprintf(stdout, "net ipaddress is %s\n", addr);
+			} else if (json_token_streq(json, &toks[i], "netMask")) {
+				free(mask);
+				mask = (json_token_str(json, &toks[++i]));
+				fprintf(stdout, "net mask is %s\n", mask);
+			} else {
+				fprintf(stderr, "get unknown section %s in ipAddresses\n",
+					json_token_str(json, &toks[i]));
+				goto fail;
+			}
+		}
+
+		if (addr == NULL) {
+			fprintf(stderr, "ipAddresses entry without ipAddress\n");
+			goto fail;
+		}
+
+		if (hyper_add_ipaddress(iface, addr, mask) < 0)
+			goto fail;
+	}
+
+	return i;
+fail:
+	free(addr);
+	free(mask);
+	return -1;
+}
+
 static int hyper_parse_interface(struct hyper_interface *iface,
 				 char *json, jsmntok_t *toks)
 {
-	int i = 0, j, next_if;
+	int i = 0, j, next_if, next;
+	char *addr = NULL, *mask = NULL;
 
 	if (toks[i].type != JSMN_OBJECT) {
 		fprintf(stdout, "network array need object\n");
@@ -771,11 +883,28 @@ static int hyper_parse_interface(struct hyper_interface *iface,
 			iface->device = (json_token_str(json, &toks[++i]));
 			fprintf(stdout, "net device is %s\n", iface->device);
 		} else if (json_token_streq(json, &toks[i], "ipAddress")) {
-			iface->ipaddr = (json_token_str(json, &toks[++i]));
-			fprintf(stdout, "net ipaddress is %s\n", iface->ipaddr);
+			addr = (json_token_str(json, &toks[++i]));
+			fprintf(stdout, "net ipaddress is %s\n", addr);
 		} else if (json_token_streq(json, &toks[i], "netMask")) {
-			iface->mask = (json_token_str(json, &toks[++i]));
-			fprintf(stdout, "net mask is %s\n", iface->mask);
+			mask = (json_token_str(json, &toks[++i]));
+			fprintf(stdout, "net mask is %s\n", mask);
+		} else if (json_token_streq(json, &toks[i], "ipAddresses")) {
+			next = hyper_parse_ipaddresses(iface, json, &toks[++i]);
+			if (next < 0)
+				goto fail;
+			i += next - 1;
+		} else if (json_token_streq(json, &toks[i], "mtu")) {
+			iface->mtu = json_token_int(json, &toks[++i]);
+			fprintf(stdout, "net mtu is %u\n", iface->mtu);
+		} else if (json_token_streq(json, &toks[i], "txQueueLen")) {
+			iface->txqueuelen = json_token_int(json, &toks[++i]);
+			fprintf(stdout, "net txqueuelen is %u\n", iface->txqueuelen);
+		} else if (json_token_streq(json, &toks[i], "queues")) {
+			iface->queues = json_token_int(json, &toks[++i]);
+			fprintf(stdout, "net queues is %u\n", iface->queues);
+		} else if (json_token_streq(json, &toks[i], "rpsCpus")) {
+			iface->rps_cpus = (json_token_str(json, &toks[++i]));
+			fprintf(stdout, "net rps cpus is %s\n", iface->rps_cpus);
 		} else {
 			fprintf(stderr, "get unknown section %s in interfaces\n",
 				json_token_str(json, &toks[i]));
@@ -783,12 +912,25 @@ static int hyper_parse_interface(struct hyper_interface *iface,
 		}
 	}
 
+	/* the legacy ipAddress/netMask pair is the primary address */
+	if (addr != NULL) {
+		if (hyper_add_ipaddress(iface, addr, mask) < 0)
+			goto fail;
+		memmove(&iface->ipaddrs[1], &iface->ipaddrs[0],
+			(iface->ipaddr_num - 1) * sizeof(*iface->ipaddrs));
+		iface->ipaddrs[0].addr = addr;
+		iface->ipaddrs[0].mask = mask;
+	} else if (mask != NULL) {
+		fprintf(stderr, "netMask without ipAddress in interfaces\n");
+		goto fail;
+	}
+
 	return i;
 
 fail:
-	free(iface->device);
-	free(iface->ipaddr);
-	free(iface->mask);
+	free(addr);
+	free(mask);
+	hyper_free_interface(iface);
 	return -1;
 }
 
@@ -1064,6 +1206,45 @@ static int hyper_parse_portmapping_external_networks(struct portmapping_white_li
 	return i;
 }
 
+static int hyper_parse_share_options(struct hyper_pod *pod, char *json, jsmntok_t *toks)
+{
+	struct hyper_share_options *opt = &pod->share_opt;
+	int i = 0, j, toks_size;
+
+	if (toks[i].type != JSMN_OBJECT) {
+		fprintf(stdout, "shareDirOptions format incorrect\n");
+		return -1;
+	}
+
+	toks_size = toks[i].size;
+	i++;
+	for (j = 0; j < toks_size; j++, i++) {
+		if (json_token_streq(json, &toks[i], "fstype")) {
+			opt->fstype = json_token_str(json, &toks[++i]);
+			fprintf(stdout, "share dir fstype %s\n", opt->fstype);
+		} else if (json_token_streq(json, &toks[i], "msize")) {
+			opt->msize = json_token_int(json, &toks[++i]);
+			fprintf(stdout, "share dir msize %" PRIu32 "\n", opt->msize);
+		} else if (json_token_streq(json, &toks[i], "cache")) {
+			opt->cache = json_token_str(json, &toks[++i]);
+			fprintf(stdout, "share dir cache %s\n", opt->cache);
+		} else if (json_token_streq(json, &toks[i], "version")) {
+			opt->version = json_token_str(json, &toks[++i]);
+			fprintf(stdout, "share dir version %s\n", opt->version);
+		} else if (json_token_streq(json, &toks[i], "dax")) {
+			if (!json_token_streq(json, &toks[++i], "false"))
+				opt->dax = 1;
+			fprintf(stdout, "share dir dax %d\n", opt->dax);
+		} else {
+			fprintf(stdout, "get unknown section %s in shareDirOptions\n",
+				json_token_str(json, &toks[i]));
+			return -1;
+		}
+	}
+
+	return i;
+}
+
 static int hyper_parse_portmapping_whitelist(struct hyper_pod *pod, char *json, jsmntok_t *toks)
 {
 	int i = 0, j, toks_size, next;
@@ -1188,6 +1369,12 @@ realloc:
 			pod->share_tag = (json_token_str(json, &toks[++i]));
 			fprintf(stdout, "share tag is %s\n", pod->share_tag);
 			i++;
+		} else if (json_token_streq(json, t, "shareDirOptions") && t->size == 1) {
+			next = hyper_parse_share_options(pod, json, &toks[++i]);
+			if (next < 0)
+				goto out;
+
+			i += next;
 		} else if (json_token_streq(json, t, "hostname") && t->size == 1) {
 			pod->hostname = (json_token_str(json, &toks[++i]));
 			fprintf(stdout, "hostname is %s\n", pod->hostname);
@@ -1200,6 +1387,10 @@ realloc:
 				pod->policy = POLICY_ONFAILURE;
 			fprintf(stdout, "restartPolicy is %" PRIu8 "\n", pod->policy);
 			i++;
+		} else if (json_token_streq(json, t, "timeSyncInterval") && t->size == 1) {
+			pod->time_sync = json_token_int(json, &toks[++i]);
+			fprintf(stdout, "time sync interval is %" PRIu32 "\n", pod->time_sync);
+			i++;
 		} else if (json_token_streq(json, t, "portmappingWhiteLists") && t->size == 1) {
 			next = hyper_parse_portmapping_whitelist(pod, json, &toks[++i]);
 			if (next < 0)
@@ -1294,6 +1485,7 @@ realloc:
 	exec->stdinfd = -1;
 	exec->stdoutfd = -1;
 	exec->stderrfd = -1;
+	exec->pidfd = -1;
 	exec->stdinev.fd = -1;
 	exec->stdoutev.fd = -1;
 	exec->stderrev.fd = -1;
@@ -1333,6 +1525,70 @@ fail:
 	goto out;
 }
 
+/*
+ * {"execs": [execcmd, ...]}, every element is parsed by hyper_parse_execcmd
+ * in place. Elements failing to parse are left NULL in *execs.
+ */
+int hyper_parse_execcmds(char *json, int length, struct hyper_exec ***execs)
+{
+	int i, j, n, num = -1;
+	jsmn_parser p;
+	int toks_num = 64;
+	jsmntok_t *toks = NULL;
+
+	*execs = NULL;
+realloc:
+	toks = realloc(toks, toks_num * sizeof(jsmntok_t));
+	if (toks == NULL) {
+		fprintf(stderr, "allocate tokens for execcmds failed\n");
+		goto out;
+	}
+
+	jsmn_init(&p);
+	n = jsmn_parse(&p, json, length,  toks, toks_num);
+	if (n < 0) {
+		fprintf(stdout, "jsmn parse failed, n is %d\n", n);
+		if (n == JSMN_ERROR_NOMEM) {
+			toks_num *= 2;
+			goto realloc;
+		}
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (toks[i].type == JSMN_STRING && toks[i].size == 1 &&
+		    json_token_streq(json, &toks[i], "execs"))
+			break;
+	}
+
+	if (i >= n - 1 || toks[++i].type != JSMN_ARRAY) {
+		fprintf(stderr, "execcmds format error, has no execs array\n");
+		goto out;
+	}
+
+	*execs = calloc(toks[i].size, sizeof(struct hyper_exec *));
+	if (*execs == NULL && toks[i].size > 0) {
+		fprintf(stderr, "allocate memory for execcmds failed\n");
+		goto out;
+	}
+
+	num = toks[i].size;
+	for (j = 0, i++; j < num; j++) {
+		jsmntok_t *t = &toks[i];
+		int end = t->end;
+
+		if (t->type == JSMN_OBJECT)
+			(*execs)[j] = hyper_parse_execcmd(json + t->start, t->end - t->start);
+
+		/* skip the tokens of this element */
+		for (i++; i < n && toks[i].start < end; i++);
+	}
+
+out:
+	free(toks);
+	return num;
+}
+
 int hyper_parse_write_file(struct hyper_writter *writter, char *json, int length)
 {
 	int i, n, ret = -1;
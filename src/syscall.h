@@ -1,5 +1,8 @@
 #define _GNU_SOURCE
 #include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/syscall.h>
 
 /*
@@ -14,3 +17,104 @@ static inline int setns(int fd, int nstype)
 	return errno == 0 ? 0 : -1;
 }
 #endif
+
+#if !defined(HAVE_COPY_FILE_RANGE)
+static inline ssize_t copy_file_range(int fd_in, loff_t *off_in, int fd_out,
+				      loff_t *off_out, size_t len, unsigned int flags)
+{
+#if defined(__NR_copy_file_range)
+	return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len, flags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+#endif
+
+/*
+ * New mount api, glibc >= 2.36 declares it in <sys/mount.h>. Callers fall
+ * back to mount(2) on ENOSYS.
+ */
+#ifndef OPEN_TREE_CLONE
+#define OPEN_TREE_CLONE		1
+#endif
+#ifndef OPEN_TREE_CLOEXEC
+#define OPEN_TREE_CLOEXEC	O_CLOEXEC
+#endif
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH		0x1000
+#endif
+#ifndef AT_RECURSIVE
+#define AT_RECURSIVE		0x8000
+#endif
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+#define MOVE_MOUNT_F_EMPTY_PATH	0x00000004
+#endif
+#ifndef MOUNT_ATTR_RDONLY
+#define MOUNT_ATTR_RDONLY	0x00000001
+#endif
+
+#if !defined(HAVE_OPEN_TREE)
+static inline int open_tree(int dfd, const char *filename, unsigned int flags)
+{
+#if defined(__NR_open_tree)
+	return syscall(__NR_open_tree, dfd, filename, flags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+#endif
+
+#if !defined(HAVE_MOVE_MOUNT)
+static inline int move_mount(int from_dfd, const char *from_path,
+			     int to_dfd, const char *to_path, unsigned int flags)
+{
+#if defined(__NR_move_mount)
+	return syscall(__NR_move_mount, from_dfd, from_path, to_dfd, to_path, flags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+#endif
+
+#if !defined(HAVE_MOUNT_SETATTR)
+struct mount_attr {
+	uint64_t attr_set;
+	uint64_t attr_clr;
+	uint64_t propagation;
+	uint64_t userns_fd;
+};
+
+static inline int mount_setattr(int dfd, const char *path, unsigned int flags,
+				struct mount_attr *attr, size_t size)
+{
+#if defined(__NR_mount_setattr)
+	return syscall(__NR_mount_setattr, dfd, path, flags, attr, size);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+#endif
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD		0x00001000
+#endif
+
+#if defined(HAVE_PIDFD_SEND_SIGNAL)
+#include <sys/pidfd.h>
+#else
+#include <signal.h>
+static inline int pidfd_send_signal(int pidfd, int sig, siginfo_t *info,
+				    unsigned int flags)
+{
+#if defined(__NR_pidfd_send_signal)
+	return syscall(__NR_pidfd_send_signal, pidfd, sig, info, flags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+#endif
@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/vm_sockets.h>
+
+#include "../config.h"
+#include "hyper.h"
+#include "uevent.h"
+#include "transport.h"
+
+/* the value of key=value in the kernel cmdline, NULL if it isn't there */
+static char *hyper_cmdline_value(char *cmdline, const char *key)
+{
+	size_t klen = strlen(key);
+	char *p = cmdline;
+
+	while (p != NULL && *p != '\0') {
+		size_t len;
+
+		p += strspn(p, " \t\n");
+		len = strcspn(p, " \t\n");
+		if (len > klen && !strncmp(p, key, klen) && p[klen] == '=')
+			return strndup(p + klen + 1, len - klen - 1);
+		p += len;
+	}
+
+	return NULL;
+}
+
+/*
+ * hyper.transport=vsock[:port] or hyper.transport=unix:path picks a
+ * socket transport, hyper.ttys=N how many tty connections follow the
+ * control one. Without hyper.transport the serial ports are used, unless
+ * the vm has a vsock device and the control port doesn't show up within
+ * the usual device timeout.
+ */
+int hyper_parse_transport(struct hyper_transport *t, char *cmdline)
+{
+	char *value, *end;
+
+	memset(t, 0, sizeof(*t));
+	t->type = HYPER_TRANSPORT_SERIAL;
+	t->port = HYPER_VSOCK_PORT;
+	t->ntty = 1;
+
+	value = hyper_cmdline_value(cmdline, "hyper.ttys");
+	if (value != NULL) {
+		t->ntty = strtol(value, &end, 10);
+		if (*end != '\0' || t->ntty < 1 || t->ntty > HYPER_TTY_CHANNELS_MAX) {
+			fprintf(stderr, "invalid hyper.ttys %s\n", value);
+			free(value);
+			return -1;
+		}
+		free(value);
+	}
+
+	value = hyper_cmdline_value(cmdline, "hyper.transport");
+	if (value == NULL) {
+#ifndef WITH_VBOX
+		struct hyper_device dev = {
+			.type	= HYPER_DEV_VIRTIO_PORT,
+			.id	= "sh.hyper.channel.0",
+		};
+
+		/* virtio-serial ports may be enumerated after init started */
+		if (access("/dev/vsock", F_OK) == 0 &&
+		    hyper_wait_device(&dev, HYPER_DEVICE_TIMEOUT) < 0) {
+			fprintf(stdout, "no hyper serial port, use vsock\n");
+			t->type = HYPER_TRANSPORT_VSOCK;
+		}
+#endif
+		return 0;
+	}
+
+	if (!strcmp(value, "serial")) {
+		t->type = HYPER_TRANSPORT_SERIAL;
+	} else if (!strncmp(value, "vsock", 5) &&
+		   (value[5] == '\0' || value[5] == ':')) {
+		t->type = HYPER_TRANSPORT_VSOCK;
+		if (value[5] == ':') {
+			t->port = strtoul(value + 6, &end, 10);
+			if (*end != '\0' || end == value + 6)
+				goto invalid;
+		}
+	} else if (!strncmp(value, "unix:", 5) && value[5] != '\0') {
+		t->type = HYPER_TRANSPORT_UNIX;
+		t->path = strdup(value + 5);
+		if (t->path == NULL)
+			goto invalid;
+	} else {
+		goto invalid;
+	}
+
+	free(value);
+	return 0;
+
+invalid:
+	fprintf(stderr, "invalid hyper.transport %s\n", value);
+	free(value);
+	return -1;
+}
+
+int hyper_transport_listen(struct hyper_transport *t)
+{
+	struct sockaddr_vm vm = {
+		.svm_family	= AF_VSOCK,
+		.svm_cid	= VMADDR_CID_ANY,
+		.svm_port	= t->port,
+	};
+	struct sockaddr_un un = {
+		.sun_family	= AF_UNIX,
+	};
+	struct sockaddr *addr;
+	socklen_t len;
+	int fd;
+
+	if (t->type == HYPER_TRANSPORT_VSOCK) {
+		fprintf(stdout, "listen on vsock port %u\n", t->port);
+		addr = (struct sockaddr *)&vm;
+		len = sizeof(vm);
+	} else {
+		if (strlen(t->path) >= sizeof(un.sun_path)) {
+			fprintf(stderr, "unix socket path %s too long\n", t->path);
+			return -1;
+		}
+		fprintf(stdout, "listen on unix socket %s\n", t->path);
+		strcpy(un.sun_path, t->path);
+		unlink(t->path);
+		addr = (struct sockaddr *)&un;
+		len = sizeof(un);
+	}
+
+	fd = socket(addr->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("create transport socket failed");
+		return -1;
+	}
+
+	if (bind(fd, addr, len) < 0) {
+		perror("bind transport socket failed");
+		goto fail;
+	}
+
+	/* the host may queue all its connections before the first accept */
+	if (listen(fd, HYPER_TTY_CHANNELS_MAX + 1) < 0) {
+		perror("listen on transport socket failed");
+		goto fail;
+	}
+
+	return fd;
+fail:
+	close(fd);
+	return -1;
+}
+
+int hyper_transport_accept(int lfd, int nonblock)
+{
+	int fd;
+
+	do {
+		fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | (nonblock ? SOCK_NONBLOCK : 0));
+	} while (fd < 0 && errno == EINTR);
+
+	if (fd < 0)
+		perror("accept transport connection failed");
+
+	return fd;
+}
+
+void hyper_free_transport(struct hyper_transport *t)
+{
+	free(t->path);
+	t->path = NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include <stdint.h>
+
+enum {
+	HYPER_TRANSPORT_SERIAL,	/* virtio-serial ports, serial lines on vbox */
+	HYPER_TRANSPORT_VSOCK,	/* the host connects to a vsock port */
+	HYPER_TRANSPORT_UNIX,	/* AF_UNIX stand-in of vsock, for testing */
+};
+
+#define HYPER_VSOCK_PORT	2718
+
+struct hyper_transport {
+	int		type;
+	uint32_t	port;
+	char		*path;
+	/* tty connections the host opens after the control one */
+	int		ntty;
+};
+
+int hyper_parse_transport(struct hyper_transport *t, char *cmdline);
+int hyper_transport_listen(struct hyper_transport *t);
+int hyper_transport_accept(int lfd, int nonblock);
+void hyper_free_transport(struct hyper_transport *t);
+
+#endif
@@ -0,0 +1,458 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "hyper.h"
+#include "util.h"
+#include "parse.h"
+#include "uevent.h"
+
+int hyper_online_movable;
+
+int hyper_uevent_open(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,	/* kernel uevents */
+	};
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0) {
+		perror("create uevent socket failed");
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind uevent socket failed");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* returns 1 if onlined, 0 if already online, -1 on error */
+static int hyper_online_file(const char *path, const char *online, const char *value)
+{
+	char buf[32];
+	ssize_t size;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		/* cpu0 has no online file */
+		if (errno == ENOENT)
+			return 0;
+		fprintf(stderr, "open %s failed\n", path);
+		return -1;
+	}
+
+	size = read(fd, buf, sizeof(buf) - 1);
+	if (size > 0) {
+		buf[size] = '\0';
+		if (strncmp(buf, online, strlen(online)) == 0) {
+			close(fd);
+			return 0;
+		}
+	}
+
+	if (write(fd, value, strlen(value)) < 0) {
+		fprintf(stderr, "write %s to %s failed: %s\n",
+			value, path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+	fprintf(stdout, "online %s\n", path);
+	return 1;
+}
+
+static int hyper_online_cpu(const char *name)
+{
+	char path[256];
+
+	sprintf(path, "/sys/devices/system/cpu/%s/online", name);
+	return hyper_online_file(path, "1", "1");
+}
+
+static int hyper_online_memory(const char *name)
+{
+	char path[256];
+
+	sprintf(path, "/sys/devices/system/memory/%s/state", name);
+	return hyper_online_file(path, "online",
+				 hyper_online_movable ? "online_movable" : "online");
+}
+
+static int hyper_online_dir(const char *dir, const char *prefix,
+			    int (*online)(const char *))
+{
+	struct dirent *entry;
+	int num, ret = 0;
+	DIR *dp;
+
+	dp = opendir(dir);
+	if (dp == NULL) {
+		fprintf(stderr, "open dir %s failed\n", dir);
+		return -1;
+	}
+
+	while ((entry = readdir(dp)) != NULL) {
+		if (strncmp(entry->d_name, prefix, strlen(prefix)) ||
+		    sscanf(entry->d_name + strlen(prefix), "%d", &num) != 1)
+			continue;
+
+		if (online(entry->d_name) < 0)
+			ret = -1;
+	}
+
+	closedir(dp);
+	return ret;
+}
+
+/* online every cpu and memory block which is still offline */
+int hyper_online_cpu_mem(void)
+{
+	int ret = 0;
+
+	if (hyper_online_dir("/sys/devices/system/cpu", "cpu", hyper_online_cpu) < 0)
+		ret = -1;
+
+	if (hyper_online_dir("/sys/devices/system/memory", "memory", hyper_online_memory) < 0)
+		ret = -1;
+
+	return ret;
+}
+
+int hyper_cmd_online_cpu_mem(char *json, int length)
+{
+	JSON_Value *value;
+
+	if (length > 0) {
+		value = hyper_json_parse(json, length);
+		if (value == NULL) {
+			fprintf(stderr, "parse online cpu mem request failed\n");
+			return -1;
+		}
+
+		if (json_object_get_value(json_object(value), "movable") != NULL)
+			hyper_online_movable =
+				json_object_get_boolean(json_object(value), "movable") > 0;
+		json_value_free(value);
+	}
+
+	/*
+	 * the uevent listener has onlined most of the new devices already,
+	 * the sweep catches the rest, so the ack means everything is online.
+	 */
+	return hyper_online_cpu_mem();
+}
+
+/*
+ * uevent message: "ACTION@DEVPATH\0ACTION=add\0DEVPATH=...\0SUBSYSTEM=cpu\0..."
+ */
+static void hyper_handle_uevent(char *buf, int len)
+{
+	char *action = NULL, *subsystem = NULL, *devpath = NULL, *name;
+	char *p = buf, *end = buf + len;
+
+	for (p += strlen(p) + 1; p < end; p += strlen(p) + 1) {
+		if (strncmp(p, "ACTION=", 7) == 0)
+			action = p + 7;
+		else if (strncmp(p, "SUBSYSTEM=", 10) == 0)
+			subsystem = p + 10;
+		else if (strncmp(p, "DEVPATH=", 8) == 0)
+			devpath = p + 8;
+	}
+
+	if (action == NULL || subsystem == NULL || devpath == NULL ||
+	    strcmp(action, "add"))
+		return;
+
+	name = strrchr(devpath, '/');
+	if (name == NULL)
+		return;
+	name++;
+
+	if (strcmp(subsystem, "cpu") == 0 && strncmp(name, "cpu", 3) == 0)
+		hyper_online_cpu(name);
+	else if (strcmp(subsystem, "memory") == 0 && strncmp(name, "memory", 6) == 0)
+		hyper_online_memory(name);
+}
+
+static int hyper_uevent_read(struct hyper_event *he, int efd)
+{
+	struct sockaddr_nl addr;
+	char buf[4096];
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) - 1 };
+	struct msghdr msg = {
+		.msg_name	= &addr,
+		.msg_namelen	= sizeof(addr),
+		.msg_iov	= &iov,
+		.msg_iovlen	= 1,
+	};
+	ssize_t size;
+
+	for (;;) {
+		msg.msg_namelen = sizeof(addr);
+		size = recvmsg(he->fd, &msg, 0);
+		if (size < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			/* ENOBUFS: events were lost, the next ONLINECPUMEM sweep recovers */
+			perror("recv uevent failed");
+			break;
+		}
+
+		/* only the kernel may make us online cpus and memory */
+		if (msg.msg_namelen != sizeof(addr) || addr.nl_pid != 0) {
+			fprintf(stderr, "drop uevent from pid %u\n", addr.nl_pid);
+			continue;
+		}
+
+		buf[size] = '\0';
+		hyper_handle_uevent(buf, size);
+	}
+
+	return 0;
+}
+
+static int hyper_uevent_drain(int fd)
+{
+	char buf[4096];
+
+	while (recv(fd, buf, sizeof(buf), 0) >= 0 || errno == EINTR)
+		;
+
+	return errno == EAGAIN ? 0 : -1;
+}
+
+/*
+ * Wait until ready(data) returns 1, checking again whenever a uevent
+ * arrives on fd. fd must be opened by hyper_uevent_open() before the
+ * device can show up, so no event is missed.
+ */
+int hyper_uevent_wait(int fd, int (*ready)(void *), void *data, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	struct timespec start, now;
+	int ret, left = timeout_ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (;;) {
+		ret = ready(data);
+		if (ret != 0)
+			return ret < 0 ? -1 : 0;
+
+		if (left <= 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		ret = poll(&pfd, 1, left);
+		if (ret < 0 && errno != EINTR) {
+			perror("poll uevent failed");
+			return -1;
+		}
+		/* ENOBUFS just means events were lost, ready() rechecks anyway */
+		if (ret > 0 && hyper_uevent_drain(fd) < 0 && errno != ENOBUFS) {
+			perror("recv uevent failed");
+			return -1;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left = timeout_ms - (now.tv_sec - start.tv_sec) * 1000 -
+		       (now.tv_nsec - start.tv_nsec) / 1000000;
+	}
+}
+
+static int hyper_dev_node_ready(struct hyper_device *dev, const char *name)
+{
+	char path[512];
+
+	/* a node name too long for dev->name is never ready */
+	if (snprintf(dev->name, sizeof(dev->name), "%s", name) >= sizeof(dev->name))
+		return 0;
+	sprintf(path, "/dev/%s", dev->name);
+	return access(path, F_OK) == 0;
+}
+
+/* the first entry of a sysfs directory, e.g. the block dev of a disk */
+static int hyper_sysfs_first(const char *dir, char *name, size_t size)
+{
+	struct dirent *de;
+	int ret = 0;
+	DIR *dp;
+
+	dp = opendir(dir);
+	if (dp == NULL)
+		return 0;
+
+	while ((de = readdir(dp)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		ret = snprintf(name, size, "%s", de->d_name) < size;
+		break;
+	}
+
+	closedir(dp);
+	return ret;
+}
+
+/* the sd driver attached the lun and devtmpfs created the node */
+static int hyper_scsi_ready(struct hyper_device *dev)
+{
+	char path[512], name[64];
+
+	sprintf(path, "/sys/class/scsi_disk/0:0:%s/device/block/", dev->id);
+	return hyper_sysfs_first(path, name, sizeof(name)) &&
+	       hyper_dev_node_ready(dev, name);
+}
+
+/* a virtio-blk disk at a pci address, "0000:00:05.0" or "00:05.0" */
+static int hyper_pci_ready(struct hyper_device *dev)
+{
+	char path[512], name[64], virtio[64];
+	const char *domain = strchr(dev->id, ':') == strrchr(dev->id, ':') ? "0000:" : "";
+	struct dirent *de;
+	int ret = 0;
+	DIR *dp;
+
+	sprintf(path, "/sys/bus/pci/devices/%s%s/", domain, dev->id);
+	dp = opendir(path);
+	if (dp == NULL)
+		return 0;
+
+	while ((de = readdir(dp)) != NULL) {
+		if (strncmp(de->d_name, "virtio", 6) == 0) {
+			ret = snprintf(virtio, sizeof(virtio), "%s", de->d_name) < sizeof(virtio);
+			break;
+		}
+	}
+	closedir(dp);
+
+	if (!ret)
+		return 0;
+
+	sprintf(path, "/sys/bus/pci/devices/%s%s/%s/block/", domain, dev->id, virtio);
+	return hyper_sysfs_first(path, name, sizeof(name)) &&
+	       hyper_dev_node_ready(dev, name);
+}
+
+/* a virtio serial port by its name, e.g. sh.hyper.channel.0 */
+static int hyper_virtio_port_ready(struct hyper_device *dev)
+{
+	char path[512], name[128];
+	struct dirent *de;
+	ssize_t size;
+	int fd, ret = 0;
+	DIR *dp;
+
+	dp = opendir("/sys/class/virtio-ports/");
+	if (dp == NULL)
+		return 0;
+
+	while ((de = readdir(dp)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		sprintf(path, "/sys/class/virtio-ports/%s/name", de->d_name);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		size = read(fd, name, sizeof(name) - 1);
+		close(fd);
+		if (size <= 0)
+			continue;
+
+		name[size] = '\0';
+		if (name[size - 1] == '\n')
+			name[size - 1] = '\0';
+		if (strcmp(name, dev->id))
+			continue;
+
+		ret = hyper_dev_node_ready(dev, de->d_name);
+		break;
+	}
+
+	closedir(dp);
+	return ret;
+}
+
+static int hyper_device_ready(void *data)
+{
+	struct hyper_device *dev = data;
+
+	switch (dev->type) {
+	case HYPER_DEV_NAME:
+		return hyper_dev_node_ready(dev, dev->id);
+	case HYPER_DEV_SCSI:
+		return hyper_scsi_ready(dev);
+	case HYPER_DEV_PCI:
+		return hyper_pci_ready(dev);
+	case HYPER_DEV_VIRTIO_PORT:
+		return hyper_virtio_port_ready(dev);
+	}
+
+	return -1;
+}
+
+/* wait for dev with a uevent socket opened before dev was plugged */
+int hyper_uevent_wait_device(int fd, struct hyper_device *dev, int timeout_ms)
+{
+	if (hyper_uevent_wait(fd, hyper_device_ready, dev, timeout_ms) < 0) {
+		fprintf(stderr, "wait for device %s (type %d) failed: %s\n",
+			dev->id, dev->type, strerror(errno));
+		return -1;
+	}
+
+	fprintf(stdout, "device %s is /dev/%s\n", dev->id, dev->name);
+	return 0;
+}
+
+/*
+ * Resolve dev to its node under /dev, waiting up to timeout_ms for it to
+ * show up. Mounts can go ahead as soon as the kernel created the device
+ * instead of failing and being retried by the host.
+ */
+int hyper_wait_device(struct hyper_device *dev, int timeout_ms)
+{
+	int fd, ret;
+
+	/* the common case, no need for a socket */
+	if (hyper_device_ready(dev) > 0)
+		return 0;
+
+	fd = hyper_uevent_open();
+	if (fd < 0)
+		return -1;
+
+	ret = hyper_uevent_wait_device(fd, dev, timeout_ms);
+	close(fd);
+	return ret;
+}
+
+/* resolve dev only if it is already there, for optional devices */
+int hyper_device_present(struct hyper_device *dev)
+{
+	return hyper_device_ready(dev) > 0;
+}
+
+struct hyper_event_ops hyper_uevent_ops = {
+	.read		= hyper_uevent_read,
+};
@@ -0,0 +1,36 @@
+#ifndef _UEVENT_H_
+#define _UEVENT_H_
+
+#include "event.h"
+
+/* onlined memory goes to ZONE_MOVABLE so it can be unplugged again */
+extern int hyper_online_movable;
+
+/* how long to wait for a hot-plugged device to show up, in ms */
+#define HYPER_DEVICE_TIMEOUT	10000
+
+int hyper_uevent_open(void);
+int hyper_uevent_wait(int fd, int (*ready)(void *), void *data, int timeout_ms);
+
+enum {
+	HYPER_DEV_NAME,		/* /dev/<id> */
+	HYPER_DEV_SCSI,		/* "target:lun" on host0 channel 0 */
+	HYPER_DEV_PCI,		/* virtio-blk at pci address <id> */
+	HYPER_DEV_VIRTIO_PORT,	/* virtio serial port named <id> */
+};
+
+struct hyper_device {
+	int	type;
+	char	*id;
+	/* the node under /dev, filled once the device is ready */
+	char	name[64];
+};
+
+int hyper_uevent_wait_device(int fd, struct hyper_device *dev, int timeout_ms);
+int hyper_wait_device(struct hyper_device *dev, int timeout_ms);
+int hyper_device_present(struct hyper_device *dev);
+int hyper_online_cpu_mem(void);
+int hyper_cmd_online_cpu_mem(char *json, int length);
+
+extern struct hyper_event_ops hyper_uevent_ops;
+#endif
@@ -0,0 +1,329 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <grp.h>
+#include <pwd.h>
+
+#include "user.h"
+
+static int hyper_self_mntns = -1;
+
+static unsigned long id_or_max(const char *name)
+{
+	char *ptr;
+	long id;
+
+	errno = 0;
+	id = strtol(name, &ptr, 10);
+	if (name == ptr || id < 0 || (errno != 0 && id == 0) || *ptr != '\0')
+		return ~0UL;
+	return id;
+}
+
+static unsigned int hyper_name_hash(const char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*name)
+		hash = hash * 33 + (unsigned char)*name++;
+
+	return hash % HYPER_USER_BUCKETS;
+}
+
+static int hyper_same_file(struct stat *a, struct stat *b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+	       a->st_size == b->st_size &&
+	       a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+	       a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static struct hyper_pwent *hyper_cache_find_pw(struct hyper_user_cache *cache, const char *name)
+{
+	struct hyper_pwent *pw;
+
+	for (pw = cache->pw_name[hyper_name_hash(name)]; pw; pw = pw->name_next) {
+		if (!strcmp(pw->name, name))
+			return pw;
+	}
+
+	return NULL;
+}
+
+static struct hyper_grent *hyper_cache_find_gr(struct hyper_user_cache *cache, const char *name)
+{
+	struct hyper_grent *gr;
+
+	for (gr = cache->gr_name[hyper_name_hash(name)]; gr; gr = gr->name_next) {
+		if (!strcmp(gr->name, name))
+			return gr;
+	}
+
+	return NULL;
+}
+
+/*
+ * The same as hyper_getpwnam() was: the first entry in file order whose
+ * name is name or whose uid is the id string name.
+ */
+struct hyper_pwent *hyper_cache_getpwnam(struct hyper_user_cache *cache, const char *name)
+{
+	struct hyper_pwent *pw, *byname;
+	unsigned long id;
+
+	if (cache == NULL)
+		return NULL;
+
+	byname = hyper_cache_find_pw(cache, name);
+
+	id = id_or_max(name);
+	if (id == ~0UL)
+		return byname;
+
+	for (pw = cache->pw_id[id % HYPER_USER_BUCKETS]; pw; pw = pw->id_next) {
+		if (pw->uid == (uid_t)id)
+			break;
+	}
+
+	if (pw == NULL || (byname != NULL && byname->index < pw->index))
+		return byname;
+	return pw;
+}
+
+struct hyper_grent *hyper_cache_getgrnam(struct hyper_user_cache *cache, const char *name)
+{
+	struct hyper_grent *gr, *byname;
+	unsigned long id;
+
+	if (cache == NULL)
+		return NULL;
+
+	byname = hyper_cache_find_gr(cache, name);
+
+	id = id_or_max(name);
+	if (id == ~0UL)
+		return byname;
+
+	for (gr = cache->gr_id[id % HYPER_USER_BUCKETS]; gr; gr = gr->id_next) {
+		if (gr->gid == (gid_t)id)
+			break;
+	}
+
+	if (gr == NULL || (byname != NULL && byname->index < gr->index))
+		return byname;
+	return gr;
+}
+
+void hyper_free_user_cache(struct hyper_user_cache *cache)
+{
+	struct hyper_pwent *pw, *pwn;
+	struct hyper_grent *gr, *grn;
+
+	if (cache == NULL)
+		return;
+
+	for (pw = cache->pw_list; pw; pw = pwn) {
+		pwn = pw->next;
+		free(pw->name);
+		free(pw->dir);
+		free(pw->groups);
+		free(pw);
+	}
+
+	for (gr = cache->gr_list; gr; gr = grn) {
+		grn = gr->next;
+		free(gr->name);
+		free(gr);
+	}
+
+	free(cache);
+}
+
+/* entries keep file order, the first one wins for duplicated names and ids */
+static int hyper_load_passwd(struct hyper_user_cache *cache, FILE *file)
+{
+	struct hyper_pwent **tail = &cache->pw_list;
+	struct passwd *pwd;
+	int index = 0;
+
+	while ((pwd = fgetpwent(file)) != NULL) {
+		struct hyper_pwent *pw, *iter;
+		unsigned int h;
+
+		pw = calloc(1, sizeof(*pw));
+		if (pw == NULL)
+			return -1;
+		*tail = pw;
+		tail = &pw->next;
+
+		pw->name = strdup(pwd->pw_name);
+		pw->dir = strdup(pwd->pw_dir);
+		if (pw->name == NULL || pw->dir == NULL)
+			return -1;
+		pw->index = index++;
+		pw->uid = pwd->pw_uid;
+		pw->gid = pwd->pw_gid;
+
+		if (hyper_cache_find_pw(cache, pw->name) == NULL) {
+			h = hyper_name_hash(pw->name);
+			pw->name_next = cache->pw_name[h];
+			cache->pw_name[h] = pw;
+		}
+
+		h = pw->uid % HYPER_USER_BUCKETS;
+		for (iter = cache->pw_id[h]; iter; iter = iter->id_next) {
+			if (iter->uid == pw->uid)
+				break;
+		}
+		if (iter == NULL) {
+			pw->id_next = cache->pw_id[h];
+			cache->pw_id[h] = pw;
+		}
+	}
+
+	return 0;
+}
+
+static int hyper_load_group(struct hyper_user_cache *cache, FILE *file)
+{
+	struct hyper_grent **tail = &cache->gr_list;
+	struct group *grp;
+	int index = 0;
+
+	while ((grp = fgetgrent(file)) != NULL) {
+		struct hyper_grent *gr, *iter;
+		unsigned int h;
+		int j;
+
+		gr = calloc(1, sizeof(*gr));
+		if (gr == NULL)
+			return -1;
+		*tail = gr;
+		tail = &gr->next;
+
+		gr->name = strdup(grp->gr_name);
+		if (gr->name == NULL)
+			return -1;
+		gr->index = index++;
+		gr->gid = grp->gr_gid;
+
+		if (hyper_cache_find_gr(cache, gr->name) == NULL) {
+			h = hyper_name_hash(gr->name);
+			gr->name_next = cache->gr_name[h];
+			cache->gr_name[h] = gr;
+		}
+
+		h = gr->gid % HYPER_USER_BUCKETS;
+		for (iter = cache->gr_id[h]; iter; iter = iter->id_next) {
+			if (iter->gid == gr->gid)
+				break;
+		}
+		if (iter == NULL) {
+			gr->id_next = cache->gr_id[h];
+			cache->gr_id[h] = gr;
+		}
+
+		for (j = 0; grp->gr_mem && grp->gr_mem[j]; j++) {
+			struct hyper_pwent *pw = hyper_cache_find_pw(cache, grp->gr_mem[j]);
+			gid_t *groups;
+
+			if (pw == NULL)
+				continue;
+
+			groups = realloc(pw->groups, sizeof(gid_t) * (pw->ngroups + 1));
+			if (groups == NULL)
+				return -1;
+			pw->groups = groups;
+			pw->groups[pw->ngroups++] = gr->gid;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Reparse /etc/passwd and /etc/group of the container whose mount ns is
+ * mntns when either of them changed since the last call. Runs in init,
+ * which enters the container ns only to stat and open the files.
+ */
+int hyper_refresh_user_cache(struct hyper_user_cache **cache, int mntns)
+{
+	struct hyper_user_cache *new = NULL;
+	struct stat pst, gst;
+	FILE *pfile = NULL, *gfile = NULL;
+	int ret = -1;
+
+	if (hyper_self_mntns < 0) {
+		hyper_self_mntns = open("/proc/self/ns/mnt", O_RDONLY | O_CLOEXEC);
+		if (hyper_self_mntns < 0) {
+			perror("open init mount ns failed");
+			return -1;
+		}
+	}
+
+	if (setns(mntns, CLONE_NEWNS) < 0) {
+		perror("enter container mount ns failed");
+		return -1;
+	}
+
+	if (stat("/etc/passwd", &pst) < 0 || stat("/etc/group", &gst) < 0) {
+		perror("stat container passwd or group failed");
+		goto out;
+	}
+
+	if (*cache != NULL && hyper_same_file(&(*cache)->passwd_st, &pst) &&
+	    hyper_same_file(&(*cache)->group_st, &gst)) {
+		ret = 0;
+		goto out;
+	}
+
+	pfile = fopen("/etc/passwd", "re");
+	gfile = fopen("/etc/group", "re");
+	if (pfile == NULL || gfile == NULL) {
+		perror("open container passwd or group failed");
+		goto out;
+	}
+	ret = 1;
+out:
+	if (setns(hyper_self_mntns, CLONE_NEWNS) < 0) {
+		perror("back to init mount ns failed");
+		ret = -1;
+	}
+
+	if (ret <= 0)
+		goto fail;
+
+	fprintf(stdout, "load container passwd and group\n");
+	ret = -1;
+	new = calloc(1, sizeof(*new));
+	if (new == NULL)
+		goto fail;
+
+	new->passwd_st = pst;
+	new->group_st = gst;
+	if (hyper_load_passwd(new, pfile) < 0 ||
+	    hyper_load_group(new, gfile) < 0) {
+		fprintf(stderr, "parse container passwd or group failed\n");
+		hyper_free_user_cache(new);
+		goto fail;
+	}
+
+	hyper_free_user_cache(*cache);
+	*cache = new;
+	ret = 0;
+fail:
+	if (ret < 0) {
+		hyper_free_user_cache(*cache);
+		*cache = NULL;
+	}
+	if (pfile)
+		fclose(pfile);
+	if (gfile)
+		fclose(gfile);
+	return ret;
+}
@@ -0,0 +1,50 @@
+#ifndef _USER_H_
+#define _USER_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define HYPER_USER_BUCKETS	256
+
+struct hyper_pwent {
+	struct hyper_pwent	*next;
+	struct hyper_pwent	*name_next;
+	struct hyper_pwent	*id_next;
+	char			*name;
+	char			*dir;
+	/* line of the entry, lookups prefer the earliest match */
+	int			index;
+	uid_t			uid;
+	gid_t			gid;
+	/* groups listing the user as member in /etc/group */
+	gid_t			*groups;
+	int			ngroups;
+};
+
+struct hyper_grent {
+	struct hyper_grent	*next;
+	struct hyper_grent	*name_next;
+	struct hyper_grent	*id_next;
+	char			*name;
+	int			index;
+	gid_t			gid;
+};
+
+/* /etc/passwd and /etc/group of a container, indexed by name and id */
+struct hyper_user_cache {
+	struct stat		passwd_st;
+	struct stat		group_st;
+	struct hyper_pwent	*pw_list;
+	struct hyper_grent	*gr_list;
+	struct hyper_pwent	*pw_name[HYPER_USER_BUCKETS];
+	struct hyper_pwent	*pw_id[HYPER_USER_BUCKETS];
+	struct hyper_grent	*gr_name[HYPER_USER_BUCKETS];
+	struct hyper_grent	*gr_id[HYPER_USER_BUCKETS];
+};
+
+int hyper_refresh_user_cache(struct hyper_user_cache **cache, int mntns);
+struct hyper_pwent *hyper_cache_getpwnam(struct hyper_user_cache *cache, const char *name);
+struct hyper_grent *hyper_cache_getgrnam(struct hyper_user_cache *cache, const char *name);
+void hyper_free_user_cache(struct hyper_user_cache *cache);
+
+#endif
@@ -16,33 +16,38 @@
 #include <sys/socket.h>
 #include <sys/reboot.h>
 #include <linux/reboot.h>
-#include <grp.h>
-#include <pwd.h>
 
 #include "util.h"
 #include "hyper.h"
 #include "container.h"
+#include "uevent.h"
+#include "syscall.h"
 #include "../config.h"
 
 char *read_cmdline(void)
 {
-	return NULL;
-}
+	char buf[4096];
+	ssize_t size;
+	int fd;
 
-int hyper_setup_env(struct env *envs, int num)
-{
-	int i, ret = 0;
-	struct env *env;
+	fd = open("/proc/cmdline", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror("open /proc/cmdline failed");
+		return NULL;
+	}
 
-	for (i = 0; i < num; i++) {
-		env = &envs[i];
-		if (setenv(env->env, env->value, 1) < 0) {
-			perror("fail to setup env");
-			ret = -1;
-		}
+	size = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (size < 0) {
+		perror("read /proc/cmdline failed");
+		return NULL;
 	}
 
-	return ret;
+	buf[size] = '\0';
+	if (size > 0 && buf[size - 1] == '\n')
+		buf[size - 1] = '\0';
+
+	return strdup(buf);
 }
 
 int hyper_list_dir(char *path)
@@ -68,146 +73,6 @@ int hyper_list_dir(char *path)
 	return 0;
 }
 
-int hyper_copy_dir(char *src, char *dest)
-{
-	char cmd[512];
-	snprintf(cmd, sizeof(cmd), "/tar cf - -C %s . | /tar fx - -C %s", src, dest);
-
-	return hyper_cmd(cmd);
-}
-
-void hyper_sync_time_hctosys() {
-	int pid;
-	pid = fork();
-	if (pid < 0) {
-		perror("fail to fork to copy directory");
-	} else if (pid == 0) {
-		execlp("/busybox", "hwclock", "-s", NULL);
-		perror("exec hwclock -s command failed");
-		exit(-1);
-	}
-}
-
-int hyper_find_sd(char *addr, char **dev)
-{
-	struct dirent **list;
-	struct dirent *dir;
-	char path[512];
-	int i, num;
-
-	sprintf(path, "/sys/class/scsi_disk/0:0:%s/device/block/", addr);
-	fprintf(stdout, "orig dev %s, scan path %s\n", *dev, path);
-
-	num = scandir(path, &list, NULL, NULL);
-	if (num < 0) {
-		perror("scan path failed");
-		return -1;
-	}
-
-	for (i = 0; i < num; i++) {
-		dir = list[i];
-		if (dir->d_name[0] == '.') {
-			continue;
-		}
-
-		fprintf(stdout, "%s get %s\n", path, dir->d_name);
-		*dev = strdup(dir->d_name);
-		break;
-	}
-
-	for (i = 0; i < num; i++)
-		free(list[i]);
-
-	free(list);
-	return 0;
-}
-
-static unsigned long id_or_max(const char *name)
-{
-	char *ptr;
-	long id = strtol(name, &ptr, 10);
-	if (name == ptr || id < 0 || (errno != 0 && id == 0) || *ptr != '\0')
-		return ~0UL;
-	return id;
-}
-
-// the same as getpwnam(), but it only parses /etc/passwd and allows name to be id string
-struct passwd *hyper_getpwnam(const char *name)
-{
-	uid_t uid = (uid_t)id_or_max(name);
-	FILE *file = fopen("/etc/passwd", "r");
-	if (!file) {
-		perror("faile to open /etc/passwd");
-		return NULL;
-	}
-	for (;;) {
-		struct passwd *pwd = fgetpwent(file);
-		if (!pwd)
-			break;
-		if (!strcmp(pwd->pw_name, name) || pwd->pw_uid == uid) {
-			fclose(file);
-			return pwd;
-		}
-	}
-	fclose(file);
-	return NULL;
-}
-
-// the same as getgrnam(), but it only parses /etc/group and allows the name to be id string
-struct group *hyper_getgrnam(const char *name)
-{
-	gid_t gid = (gid_t)id_or_max(name);
-	FILE *file = fopen("/etc/group", "r");
-	if (!file) {
-		perror("faile to open /etc/group");
-		return NULL;
-	}
-	for (;;) {
-		struct group *gr = fgetgrent(file);
-		if (!gr)
-			break;
-		if (!strcmp(gr->gr_name, name) || gr->gr_gid == gid) {
-			fclose(file);
-			return gr;
-		}
-	}
-	fclose(file);
-	return NULL;
-}
-
-// the same as getgrouplist(), but it only parses /etc/group
-int hyper_getgrouplist(const char *user, gid_t group, gid_t *groups, int *ngroups)
-{
-	int nr = 0, ret;
-	FILE *file = fopen("/etc/group", "r");
-	if (!file) {
-		perror("faile to open /etc/group");
-		return -1;
-	}
-	for (;;) {
-		struct group *gr = fgetgrent(file);
-		if (!gr)
-			break;
-		int j;
-		for (j = 0; gr->gr_mem && gr->gr_mem[j]; j++) {
-			if (!strcmp(gr->gr_mem[j], user)) {
-				if (nr + 1 < *ngroups)
-					groups[nr] = gr->gr_gid;
-				nr++;
-			}
-		}
-	}
-	fclose(file);
-	if (nr == 0) {
-		if (nr + 1 < *ngroups)
-			groups[nr] = group;
-		nr++;
-	}
-	ret = nr <= *ngroups ? nr : -1;
-	*ngroups = nr;
-	return ret;
-}
-
 int hyper_write_file(const char *path, const char *value, size_t len)
 {
 	size_t size = 0, l;
@@ -287,6 +152,61 @@ int hyper_create_file(const char *hyper_path)
 	return 0;
 }
 
+static int hyper_bind_mount_legacy(const char *src, const char *dst, int flags)
+{
+	int rec = (flags & HYPER_BIND_RECURSIVE) ? MS_REC : 0;
+
+	if (mount(src, dst, NULL, MS_BIND | rec, NULL) < 0)
+		return -1;
+
+	if ((flags & HYPER_BIND_RDONLY) &&
+	    mount(src, dst, NULL, MS_BIND | MS_REMOUNT | MS_RDONLY | rec, NULL) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Bind mount src on dst. With the new mount api the bind is cloned as a
+ * detached tree, made read-only (recursively) while detached and then
+ * attached in one step, so dst never shows up half set up.
+ */
+int hyper_bind_mount(const char *src, const char *dst, int flags)
+{
+	static int no_open_tree, no_setattr;
+	struct mount_attr attr = {
+		.attr_set = MOUNT_ATTR_RDONLY,
+	};
+	unsigned int rec = (flags & HYPER_BIND_RECURSIVE) ? AT_RECURSIVE : 0;
+	int fd, ret = -1;
+
+	if (no_open_tree || ((flags & HYPER_BIND_RDONLY) && no_setattr))
+		return hyper_bind_mount_legacy(src, dst, flags);
+
+	fd = open_tree(AT_FDCWD, src, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | rec);
+	if (fd < 0) {
+		if (errno != ENOSYS)
+			return -1;
+		no_open_tree = 1;
+		return hyper_bind_mount_legacy(src, dst, flags);
+	}
+
+	if ((flags & HYPER_BIND_RDONLY) &&
+	    mount_setattr(fd, "", AT_EMPTY_PATH | rec, &attr, sizeof(attr)) < 0) {
+		if (errno == ENOSYS) {
+			no_setattr = 1;
+			close(fd);
+			return hyper_bind_mount_legacy(src, dst, flags);
+		}
+		goto out;
+	}
+
+	ret = move_mount(fd, "", AT_FDCWD, dst, MOVE_MOUNT_F_EMPTY_PATH);
+out:
+	close(fd);
+	return ret;
+}
+
 int hyper_mkdir(char *hyper_path, mode_t mode)
 {
 	struct stat st;
@@ -336,78 +256,6 @@ fail:
 	return -1;
 }
 
-void online_cpu(void)
-{
-	DIR *dir = opendir("/sys/devices/system/cpu");
-	if (dir == NULL) {
-		fprintf(stderr, "open dir /sys/devices/system/cpu failed\n");
-		return;
-	}
-	printf("online_cpu()\n");
-	for (;;) {
-		int num;
-		int ret;
-		char path[256];
-		int fd;
-
-		struct dirent *entry = readdir(dir);
-		if (entry == NULL)
-			break;
-		if (entry->d_type != DT_DIR)
-			continue;
-		ret = sscanf(entry->d_name, "cpu%d", &num);
-		if (ret < 1 || num == 0) /* skip none cpu%d and cpu0 */
-			continue;
-		sprintf(path, "/sys/devices/system/cpu/%s/online", entry->d_name);
-		fd = open(path, O_RDWR);
-		if (fd < 0) {
-			fprintf(stderr, "open %s failed\n", path);
-			continue;
-		}
-		printf("try to online %s\n", entry->d_name);
-		ret = write(fd, "1", sizeof("1"));
-		printf("online %s result: %s\n", entry->d_name, ret == 2 ? "success" : "failed");
-		close(fd);
-	}
-	closedir(dir);
-}
-
-void online_memory(void)
-{
-	DIR *dir = opendir("/sys/devices/system/memory");
-	if (dir == NULL) {
-		fprintf(stderr, "open dir /sys/devices/system/memory failed\n");
-		return;
-	}
-	printf("online_memory()\n");
-	for (;;) {
-		int num;
-		int ret;
-		char path[256];
-		int fd;
-
-		struct dirent *entry = readdir(dir);
-		if (entry == NULL)
-			break;
-		if (entry->d_type != DT_DIR)
-			continue;
-		ret = sscanf(entry->d_name, "memory%d", &num);
-		if (ret < 1 || num == 0) /* skip none memory%d and memory0 */
-			continue;
-		sprintf(path, "/sys/devices/system/memory/%s/online", entry->d_name);
-		fd = open(path, O_RDWR);
-		if (fd < 0) {
-			fprintf(stderr, "open %s failed\n", path);
-			continue;
-		}
-		printf("try to online %s\n", entry->d_name);
-		ret = write(fd, "1", sizeof("1"));
-		printf("online %s result: %s\n", entry->d_name, ret == 2 ? "success" : "failed");
-		close(fd);
-	}
-	closedir(dir);
-}
-
 #if WITH_VBOX
 
 #include <termios.h>
@@ -505,57 +353,24 @@ err:
 #else
 int hyper_open_channel(char *channel, int mode)
 {
-	struct dirent **list;
-	struct dirent *dir;
-	int fd = -1, i, num;
-	char path[256], name[128];
+	struct hyper_device dev = {
+		.type	= HYPER_DEV_VIRTIO_PORT,
+		.id	= channel,
+	};
+	char path[128];
+	int fd;
 
-	num = scandir("/sys/class/virtio-ports/", &list, NULL, NULL);
-	if (num < 0) {
-		perror("scan /sys/calss/virtio-ports/ failed");
+	if (hyper_wait_device(&dev, HYPER_DEVICE_TIMEOUT) < 0) {
+		fprintf(stderr, "channel %s is not ready\n", channel);
 		return -1;
 	}
 
-	memset(path, 0, sizeof(path));
-
-	for (i = 0; i < num; i++) {
-		dir = list[i];
-		if (dir->d_name[0] == '.')
-			continue;
-
-		if (snprintf(path, sizeof(path), "/sys/class/virtio-ports/%s/name", dir->d_name) < 0) {
-			fprintf(stderr, "get channel device %s path failed\n", dir->d_name);
-			continue;
-		}
-
-		fd = open(path, O_RDONLY);
-
-		memset(name, 0, sizeof(name));
-		if (fd < 0 || read(fd, name, sizeof(name)) < 0)
-			continue;
-
-		close(fd);
-		fd = -1;
-
-		if (strncmp(name, channel, strlen(channel))) {
-			fprintf(stderr, "channel %s, directory %s\n", channel, name);
-			continue;
-		}
-
-		if (snprintf(path, sizeof(path), "/dev/%s", dir->d_name) < 0) {
-			fprintf(stderr, "get channel device %s path failed\n", dir->d_name);
-			continue;
-		}
-
-		fprintf(stdout, "open hyper channel %s\n", path);
-		fd = open(path, O_RDWR | O_CLOEXEC | mode);
-		if (fd < 0)
-			perror("fail to open channel device");
-
-		break;
-	}
+	sprintf(path, "/dev/%s", dev.name);
+	fprintf(stdout, "open hyper channel %s\n", path);
+	fd = open(path, O_RDWR | O_CLOEXEC | mode);
+	if (fd < 0)
+		perror("fail to open channel device");
 
-	free(list);
 	return fd;
 }
 